@@ -28,25 +28,119 @@
 #ifndef Athol_API_Interfaces_h
 #define Athol_API_Interfaces_h
 
+#include <cstddef>
 #include <memory>
 #include <wayland-server.h>
 
 namespace API {
 
+struct InputEvent {
+    enum Type : uint32_t {
+        KeyboardKey,
+        PointerMotion,
+        PointerButton,
+        PointerAxis
+    };
+
+    Type type;
+    uint32_t time;
+    uint64_t timeUsec;
+
+    // KeyboardKey uses key and state, PointerButton button and state,
+    // PointerMotion dx and dy, PointerAxis axis and value.
+    uint32_t key;
+    uint32_t button;
+    uint32_t axis;
+    uint32_t state;
+    double dx;
+    double dy;
+    double value;
+};
+
 class InputClient {
 public:
     virtual void handleKeyboardEvent(uint32_t time, uint32_t key, uint32_t state) = 0;
 
     virtual void handlePointerMotion(uint32_t time, double dx, double dy) = 0;
     virtual void handlePointerButton(uint32_t time, uint32_t button, uint32_t state) = 0;
+    virtual void handlePointerAxis(uint32_t time, uint32_t axis, double value) { }
+
+    // With ATHOL_INPUT_COALESCE=1, the events of a frame are delivered here
+    // once, just before the compositor repaints, with consecutive pointer
+    // motion and axis events merged. Each merged event carries the time of
+    // the last event merged into it.
+    virtual void handleInputEvents(const InputEvent* events, size_t count)
+    {
+        for (size_t i = 0; i < count; ++i) {
+            const InputEvent& event = events[i];
+            switch (event.type) {
+            case InputEvent::KeyboardKey:
+                handleKeyboardEvent(event.time, event.key, event.state);
+                break;
+            case InputEvent::PointerMotion:
+                handlePointerMotion(event.time, event.dx, event.dy);
+                break;
+            case InputEvent::PointerButton:
+                handlePointerButton(event.time, event.button, event.state);
+                break;
+            case InputEvent::PointerAxis:
+                handlePointerAxis(event.time, event.axis, event.value);
+                break;
+            }
+        }
+    }
+};
+
+// How eagerly a surface is asked to draw. Frame callbacks of throttled
+// surfaces are held back and sent at ATHOL_HIDDEN_FRAME_RATE, or only once
+// they are no longer throttled if that is 0.
+enum class SurfacePriority {
+    // Throttled while completely covered by opaque surfaces.
+    Normal,
+    // Never throttled, for surfaces that must keep drawing while hidden.
+    Foreground,
+    // Always throttled, for apps the shell has sent to the background.
+    Background
 };
 
 class Compositor {
 public:
+    // The size of the first output.
     virtual uint32_t width() = 0;
     virtual uint32_t height() = 0;
+
+    // The size clients should render top-level surfaces at. Buffers of any
+    // size are scaled to the screen by the display hardware, so rendering
+    // below the display resolution trades sharpness for frame rate.
+    virtual uint32_t preferredRenderWidth() = 0;
+    virtual uint32_t preferredRenderHeight() = 0;
     virtual struct wl_display* display() const = 0;
     virtual void initializeInput(std::unique_ptr<InputClient>) = 0;
+
+    // Outputs are numbered in the order of ATHOL_OUTPUTS. Surfaces go to the
+    // first one, unless their client is assigned another one, which moves
+    // the surfaces it already has along.
+    virtual unsigned outputCount() = 0;
+    virtual void setClientOutput(struct wl_client*, unsigned output) = 0;
+
+    // Takes a wl_surface resource. Surfaces start with Normal priority.
+    virtual void setSurfacePriority(struct wl_resource* surface, SurfacePriority) = 0;
+
+    // Shows the wl_surface as the pointer, with the hotspot at the pointer
+    // position, or hides the pointer for a null surface. The surface takes
+    // the cursor role and leaves the stack. The compositor draws and moves
+    // the pointer itself unless ATHOL_CURSOR=0, showing its own arrow until
+    // a surface is set.
+    virtual void setCursor(struct wl_resource* surface, int32_t hotspotX, int32_t hotspotY) = 0;
+
+    // Gives the keyboard of the wl_seat to the wl_surface, or to nothing for
+    // null. Otherwise it goes to the last top-level surface clicked. The
+    // shell gets every event through its InputClient regardless.
+    virtual void setKeyboardFocus(struct wl_resource* surface) = 0;
+
+    // Makes the compositor's main loop return, from any thread. Calling
+    // wl_display_terminate() on display() does not stop it.
+    virtual void terminate() = 0;
 };
 
 } // namespace API
@@ -27,122 +27,362 @@
 
 #include "Athol.h"
 
+#include "Presentation.h"
+#include "Region.h"
+#include "Startup.h"
+#include "Subsurface.h"
 #include "Surface.h"
+#include "Trace.h"
+#include <algorithm>
+#include <csignal>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
 #include <sys/eventfd.h>
-#include <sys/time.h>
-
-Athol::BindDisplayType Athol::f_bindDisplay = nullptr;
-Athol::QueryWaylandBufferType Athol::f_queryWaylandBuffer = nullptr;
+#include <unistd.h>
 
 Athol::Athol(const char* socketName)
     : m_display(wl_display_create())
     , m_initialized(false)
+    , m_priorityLoop(wl_event_loop_create())
+    , m_prioritySource(nullptr)
+    , m_running(false)
+    , m_terminateFd(-1)
+    , m_startupFailed(false)
+    , m_renderWidth(0)
+    , m_renderHeight(0)
+    , m_reportTimer(nullptr)
+    , m_reportInterval(0)
+    , m_cursor(*this)
+    , m_seat(*this)
 {
+    Startup::begin();
+
     wl_display_add_socket(m_display, socketName);
     setenv("WAYLAND_DISPLAY", socketName, 1);
+    Startup::mark("socket accepting clients");
+
+    Startup::Phase globals("globals");
 
-    if (!wl_global_create(m_display, &wl_compositor_interface, 3, this, bindCompositorInterface))
+    // Wakes the main loop for the priority sources.
+    m_prioritySource = wl_event_loop_add_fd(wl_display_get_event_loop(m_display),
+        wl_event_loop_get_fd(m_priorityLoop), WL_EVENT_READABLE, dispatchPriorityLoop, this);
+    if (!m_prioritySource)
         return;
 
-    wl_list_init(&m_surfaceUpdateList);
+    if (!m_clientBudget.initialize(m_display, m_priorityLoop))
+        return;
 
-    m_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
-    if (m_eventfd == -1)
+    m_terminateFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_terminateFd == -1
+        || !wl_event_loop_add_fd(wl_display_get_event_loop(m_display), m_terminateFd, WL_EVENT_READABLE, terminateCallback, this))
         return;
 
-    m_vsyncSource = wl_event_loop_add_fd(wl_display_get_event_loop(m_display),
-        m_eventfd, WL_EVENT_READABLE, vsyncCallback, this);
-    m_repaintSource = nullptr;
+    if (!wl_global_create(m_display, &wl_compositor_interface, 4, this, bindCompositorInterface))
+        return;
 
-    m_backend.eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
-    eglInitialize(m_backend.eglDisplay, nullptr, nullptr);
+    if (wl_display_init_shm(m_display))
+        return;
 
-    f_bindDisplay = reinterpret_cast<BindDisplayType>(eglGetProcAddress("eglBindWaylandDisplayWL"));
-    f_queryWaylandBuffer = reinterpret_cast<QueryWaylandBufferType>(eglGetProcAddress("eglQueryWaylandBufferWL"));
+    if (!Presentation::initialize(m_display))
+        return;
 
-    f_bindDisplay(m_backend.eglDisplay, m_display);
+    if (!Subsurface::initialize(m_display))
+        return;
 
-    bcm_host_init();
+    if (!m_seat.initialize(m_display))
+        return;
 
-    m_backend.displayHandle = vc_dispmanx_display_open(DISPMANX_ID_HDMI);
+    // Before the backends start any thread.
+    if (!m_statistics.initialize(wl_display_get_event_loop(m_display)))
+        return;
 
-    graphics_get_display_size(DISPMANX_ID_HDMI, &m_width, &m_height);
+    for (int signalNumber : { SIGINT, SIGTERM }) {
+        if (!wl_event_loop_add_signal(wl_display_get_event_loop(m_display), signalNumber, signalCallback, this))
+            return;
+    }
 
-    m_initialized = true;
+#if ATHOL_TRACE
+    if (!Trace::initialize(wl_display_get_event_loop(m_display)))
+        return;
+#endif
+
+    std::vector<std::string> names;
+    if (const char* outputs = getenv("ATHOL_OUTPUTS")) {
+        std::string list(outputs);
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = std::min(list.find(',', start), list.size());
+            if (end > start)
+                names.push_back(list.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+    if (names.empty())
+        names.push_back(std::string());
+
+    for (size_t i = 0; i < names.size(); ++i) {
+        m_outputs.emplace_back(new Output(*this, i));
+        m_statistics.addOutput(m_outputs.back()->surfaceList());
+    }
+
+    if (const char* size = getenv("ATHOL_RENDER_SIZE")) {
+        unsigned width, height;
+        if (std::sscanf(size, "%ux%u", &width, &height) == 2 && width && height) {
+            m_renderWidth = width;
+            m_renderHeight = height;
+        }
+    }
+
+    if (const char* interval = getenv("ATHOL_FRAME_REPORT")) {
+        m_reportInterval = std::atoi(interval);
+        if (m_reportInterval > 0) {
+            m_reportTimer = wl_event_loop_add_timer(wl_display_get_event_loop(m_display), reportFrames, this);
+            wl_event_source_timer_update(m_reportTimer, m_reportInterval * 1000);
+        }
+    }
+
+    // EGL, bcm_host, the displays and the keymap take long enough to hold
+    // up the shell. Clients go without a keymap if it fails to compile.
+    m_startupThread = std::thread([this, names] {
+        for (size_t i = 0; i < names.size(); ++i) {
+            if (!m_outputs[i]->initializeBackend(names[i].empty() ? nullptr : names[i].c_str())) {
+                std::fprintf(stderr, "[Athol] Failed to initialize output %s\n", m_outputs[i]->name().c_str());
+                m_startupFailed = true;
+                return;
+            }
+        }
+        m_seat.compileKeymap();
+    });
 }
 
 Athol::~Athol()
 {
+    if (m_startupThread.joinable())
+        m_startupThread.join();
+
+#if ATHOL_TRACE
+    Trace::flush();
+#endif
+
+    // Surfaces go away with their clients, before the outputs they are on.
     wl_display_destroy(m_display);
-    vc_dispmanx_display_close(m_backend.displayHandle);
+    m_cursor.hide();
+    m_outputs.clear();
+    wl_event_loop_destroy(m_priorityLoop);
+
+    if (m_terminateFd != -1)
+        close(m_terminateFd);
 }
 
 void Athol::run()
 {
-    wl_display_run(m_display);
+    if (!finishStartup()) {
+        std::fprintf(stderr, "[Athol] Startup failed.\n");
+        return;
+    }
+
+    Startup::mark("dispatching clients");
+
+    // wl_display_run(), with the priority sources serviced first. Those
+    // that become ready while clients are dispatched wake the next
+    // iteration, or, after a client over its budget, are serviced as soon
+    // as the clients dispatched with it are done.
+    struct wl_event_loop* loop = wl_display_get_event_loop(m_display);
+    m_running = true;
+    while (m_running) {
+        wl_event_loop_dispatch(m_priorityLoop, 0);
+        m_clientBudget.beginIteration();
+        wl_display_flush_clients(m_display);
+        wl_event_loop_dispatch(loop, -1);
+    }
 }
 
-void Athol::scheduleRepaint(Surface& surface)
+int Athol::dispatchPriorityLoop(int, uint32_t, void* data)
 {
-    wl_list_insert(m_surfaceUpdateList.prev, &surface.link);
+    auto& athol = *static_cast<Athol*>(data);
+    wl_event_loop_dispatch(athol.m_priorityLoop, 0);
+    return 0;
+}
 
-    if (!m_repaintSource)
-        m_repaintSource = wl_event_loop_add_idle(
-            wl_display_get_event_loop(m_display), Athol::repaint, this);
+void Athol::terminate()
+{
+    uint64_t value = 1;
+    if (write(m_terminateFd, &value, sizeof(value)) != sizeof(value))
+        std::fprintf(stderr, "[Athol] Failed to signal termination\n");
 }
 
-void Athol::repaint(void* data)
+int Athol::terminateCallback(int fd, uint32_t, void* data)
 {
     auto& athol = *static_cast<Athol*>(data);
-    athol.m_repaintSource = nullptr;
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) == sizeof(value))
+        athol.m_running = false;
+    return 0;
+}
+
+int Athol::signalCallback(int, void* data)
+{
+    static_cast<Athol*>(data)->m_running = false;
+    return 0;
+}
+
+bool Athol::finishStartup()
+{
+    // Also when the constructor gave up before starting the thread.
+    if (!m_startupThread.joinable())
+        return m_initialized;
 
-    Athol::Update update(athol);
+    {
+        Startup::Phase phase("waiting for displays");
+        m_startupThread.join();
+    }
+    if (m_startupFailed)
+        return false;
+
+    // Outputs are laid out left to right, in the order they are listed.
+    Startup::Phase phase("outputs");
+    int32_t x = 0;
+    for (auto& output : m_outputs) {
+        if (!output->initialize(x)) {
+            std::fprintf(stderr, "[Athol] Failed to initialize output %s\n", output->name().c_str());
+            return false;
+        }
+        x += output->width();
+    }
+    m_cursor.initialize();
 
-    Surface* surface;
-    wl_list_for_each(surface, &athol.m_surfaceUpdateList, link)
-        surface->repaint(update);
+    m_initialized = true;
+    return true;
 }
 
-int Athol::vsyncCallback(int fd, uint32_t mask, void* data)
+uint32_t Athol::width()
 {
-    if (mask != WL_EVENT_READABLE)
-        return 1;
+    return finishStartup() ? m_outputs.front()->width() : 0;
+}
 
-    Athol& athol = *static_cast<Athol*>(data);
+uint32_t Athol::height()
+{
+    return finishStartup() ? m_outputs.front()->height() : 0;
+}
 
-    uint64_t time;
-    ssize_t ret = read(fd, &time, sizeof(time));
-    if (ret != sizeof(time))
-        return 1;
+void Athol::scheduleInputFlush()
+{
+    m_outputs.front()->scheduleRepaint();
+}
 
-    Surface* surface;
-    wl_list_for_each(surface, &athol.m_surfaceUpdateList, link)
-        surface->dispatchFrameCallbacks(time);
+void Athol::flushInput()
+{
+    m_input.flushEvents();
+}
 
-    wl_list_init(&athol.m_surfaceUpdateList);
+struct ClientOutput {
+    struct wl_listener destroyListener;
+    unsigned output;
+};
 
-    return 1;
+static void destroyClientOutput(struct wl_listener* listener, void*)
+{
+    ClientOutput* clientOutput = wl_container_of(listener, clientOutput, destroyListener);
+    wl_list_remove(&listener->link);
+    delete clientOutput;
 }
 
-void Athol::updateComplete(DISPMANX_UPDATE_HANDLE_T, void* data)
+Output& Athol::outputForClient(struct wl_client* client)
 {
-    Athol& athol = *static_cast<Athol*>(data);
+    // The destroy listener doubles as the assignment.
+    if (struct wl_listener* listener = wl_client_get_destroy_listener(client, destroyClientOutput)) {
+        ClientOutput* clientOutput = wl_container_of(listener, clientOutput, destroyListener);
+        return *m_outputs[clientOutput->output];
+    }
+    return *m_outputs.front();
+}
+
+void Athol::setClientOutput(struct wl_client* client, unsigned index)
+{
+    if (index >= m_outputs.size()) {
+        std::fprintf(stderr, "[Athol] No output %u\n", index);
+        return;
+    }
+
+    ClientOutput* clientOutput;
+    if (struct wl_listener* listener = wl_client_get_destroy_listener(client, destroyClientOutput))
+        clientOutput = wl_container_of(listener, clientOutput, destroyListener);
+    else {
+        clientOutput = new ClientOutput;
+        clientOutput->destroyListener.notify = destroyClientOutput;
+        wl_client_add_destroy_listener(client, &clientOutput->destroyListener);
+    }
+    clientOutput->output = index;
+
+    // Top-level surfaces bring their subsurfaces along.
+    Output& output = *m_outputs[index];
+    std::vector<Surface*> surfaces;
+    for (auto& other : m_outputs) {
+        if (other.get() == &output)
+            continue;
+
+        Surface* surface;
+        wl_list_for_each(surface, other->surfaceList(), stackLink) {
+            if (!surface->parent() && wl_resource_get_client(surface->resource()) == client)
+                surfaces.push_back(surface);
+        }
+    }
+    for (Surface* surface : surfaces)
+        surface->setOutput(output);
+}
+
+void Athol::setSurfacePriority(struct wl_resource* surface, API::SurfacePriority priority)
+{
+    Surface::fromResource(surface)->setPriority(priority);
+}
+
+void Athol::setCursor(struct wl_resource* surfaceResource, int32_t hotspotX, int32_t hotspotY)
+{
+    if (!surfaceResource) {
+        m_cursor.setSurface(nullptr, 0, 0);
+        return;
+    }
+
+    Surface* surface = Surface::fromResource(surfaceResource);
+    if (surface->subsurface()) {
+        std::fprintf(stderr, "[Athol] wl_surface@%u already has a role\n", wl_resource_get_id(surfaceResource));
+        return;
+    }
+
+    // The cursor shows one buffer, and its surface leaves the stack, which
+    // subsurfaces would have to follow.
+    if (surface->hasSubsurfaces()) {
+        std::fprintf(stderr, "[Athol] wl_surface@%u has subsurfaces and cannot be a cursor\n", wl_resource_get_id(surfaceResource));
+        return;
+    }
+
+    if (!surface->cursor())
+        surface->setCursor(m_cursor);
+    m_cursor.setSurface(surface, hotspotX, hotspotY);
+}
+
+void Athol::setKeyboardFocus(struct wl_resource* surface)
+{
+    m_seat.setKeyboardFocus(surface);
+}
 
-    struct timeval tv;
-    gettimeofday(&tv, nullptr);
-    uint64_t time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
+int Athol::reportFrames(void* data)
+{
+    Athol& athol = *static_cast<Athol*>(data);
+    for (auto& output : athol.m_outputs)
+        output->reportFrames(athol.m_reportInterval);
+    athol.m_clientBudget.report(athol.m_reportInterval);
 
-    ssize_t ret = write(athol.m_eventfd, &time, sizeof(time));
-    if (ret != sizeof(time))
-        return; // FIXME: At least log this.
+    wl_event_source_timer_update(athol.m_reportTimer, athol.m_reportInterval * 1000);
+    return 0;
 }
 
 void Athol::bindCompositorInterface(struct wl_client* client, void* data, uint32_t version, uint32_t id)
 {
     auto* athol = static_cast<Athol*>(data);
-    struct wl_resource* resource = wl_resource_create(client, &wl_compositor_interface, 3, id);
+    struct wl_resource* resource = wl_resource_create(client, &wl_compositor_interface, std::min<uint32_t>(version, 4), id);
     if (!resource) {
         wl_client_post_no_memory(client);
         return;
@@ -156,26 +396,15 @@ const struct wl_compositor_interface Athol::m_compositorInterface = {
     [](struct wl_client* client, struct wl_resource* resource, uint32_t id)
     {
         auto* athol = static_cast<Athol*>(wl_resource_get_user_data(resource));
-        new Surface(*athol, client, resource, id);
+        new Surface(athol->outputForClient(client), client, resource, id);
     },
     // create_region
-    [](struct wl_client*, struct wl_resource*, uint32_t)
+    [](struct wl_client* client, struct wl_resource* resource, uint32_t id)
     {
-        std::fprintf(stderr, "m_compositorInterface::create_region not implemented\n");
+        Region::createResource(client, resource, id);
     }
 };
 
-Athol::Update::Update(Athol& athol)
-    : m_athol(athol)
-{
-    m_updateHandle = vc_dispmanx_update_start(10);
-}
-
-Athol::Update::~Update()
-{
-    vc_dispmanx_update_submit(m_updateHandle, Athol::updateComplete, &m_athol);
-}
-
 struct wl_display* Athol::display() const
 {
     return m_display;
@@ -28,59 +28,70 @@
 #ifndef Athol_h
 #define Athol_h
 
+#include "ClientBudget.h"
+#include "Cursor.h"
+#include "FrameStatistics.h"
 #include "Input.h"
+#include "Output.h"
+#include "Seat.h"
 #include <API/Interfaces.h>
+#include <memory>
+#include <thread>
+#include <vector>
 #include <wayland-server.h>
 
-#include <wayland-egl.h>
-#include <EGL/egl.h>
-#include <EGL/eglext.h>
-
-#define BUILD_WAYLAND
-#include <bcm_host.h>
-
-class Surface;
-
 class Athol final : public API::Compositor {
 public:
     Athol(const char*);
     ~Athol();
 
+    // Clients can connect as soon as the compositor is created, and the
+    // shell can load, while the displays come up on a startup thread. Their
+    // requests are dispatched once run() has finished startup, until
+    // terminate() is called or SIGINT or SIGTERM is received.
     void run();
-    void scheduleRepaint(Surface&);
 
-    class Update {
-    public:
-        Update(Athol&);
-        ~Update();
+    // Waits for the displays, and brings up what depends on them. Returns
+    // whether the compositor is ready.
+    bool finishStartup();
 
-        Update(const Update&) = delete;
-        Update& operator=(const Update&) = delete;
+    // Coalesced input is delivered at the start of the next repaint of the
+    // first output, so that the shell reacts to it in time for that frame.
+    void scheduleInputFlush();
+    void flushInput();
 
-        uint32_t width() { return m_athol.m_width; }
-        uint32_t height() { return m_athol.m_height; }
+    // Where the surfaces of the client go: the output set for it with
+    // setClientOutput(), or the first one.
+    Output& outputForClient(struct wl_client*);
+    Output& output(unsigned index) { return *m_outputs[index]; }
 
-        DISPMANX_UPDATE_HANDLE_T handle() { return m_updateHandle; }
-        DISPMANX_DISPLAY_HANDLE_T displayHandle() { return m_athol.m_backend.displayHandle; }
-        EGLDisplay eglDisplay() { return m_athol.m_backend.eglDisplay; }
+    // The sources that pace the displays, update completions and repaints,
+    // are dispatched ahead of any client.
+    struct wl_event_loop* priorityLoop() { return m_priorityLoop; }
 
-    private:
-        Athol& m_athol;
-        DISPMANX_UPDATE_HANDLE_T m_updateHandle;
-    };
+    FrameStatistics& statistics() { return m_statistics; }
+    Input& input() { return m_input; }
+    Cursor& cursor() { return m_cursor; }
+    Seat& seat() { return m_seat; }
 
-    uint32_t width() { return m_width; }
-    uint32_t height() { return m_height; }
+    // API::Compositor. The size is that of the first output, which the
+    // shell may ask for before startup has finished.
+    virtual uint32_t width() override;
+    virtual uint32_t height() override;
+
+    // ATHOL_RENDER_SIZE=<width>x<height>, the display size by default.
+    virtual uint32_t preferredRenderWidth() override { return m_renderWidth ? m_renderWidth : width(); }
+    virtual uint32_t preferredRenderHeight() override { return m_renderHeight ? m_renderHeight : height(); }
 
-    // API::Compositor
     virtual struct wl_display* display() const override;
     virtual void initializeInput(std::unique_ptr<API::InputClient>) override;
 
-    using BindDisplayType = PFNEGLBINDWAYLANDDISPLAYWL;
-    static BindDisplayType f_bindDisplay;
-
-    using QueryWaylandBufferType = PFNEGLQUERYWAYLANDBUFFERWL;
-    static QueryWaylandBufferType f_queryWaylandBuffer;
+    virtual unsigned outputCount() override { return m_outputs.size(); }
+    virtual void setClientOutput(struct wl_client*, unsigned output) override;
+    virtual void setSurfacePriority(struct wl_resource*, API::SurfacePriority) override;
+    virtual void setCursor(struct wl_resource*, int32_t hotspotX, int32_t hotspotY) override;
+    virtual void setKeyboardFocus(struct wl_resource*) override;
+    virtual void terminate() override;
 
 private:
     static void bindCompositorInterface(struct wl_client*, void*, uint32_t, uint32_t);
@@ -89,23 +100,40 @@ private:
     struct wl_display* m_display;
     bool m_initialized;
 
-    struct wl_list m_surfaceUpdateList;
-    struct wl_event_source* m_vsyncSource;
-    struct wl_event_source* m_repaintSource;
-    int m_eventfd;
-    static void repaint(void*);
-    static int vsyncCallback(int, uint32_t, void*);
-    static void updateComplete(DISPMANX_UPDATE_HANDLE_T, void*);
+    struct wl_event_loop* m_priorityLoop;
+    struct wl_event_source* m_prioritySource;
+    static int dispatchPriorityLoop(int, uint32_t, void*);
+    ClientBudget m_clientBudget;
+
+    // run() cannot see wl_display_terminate(), so terminate() goes through
+    // an eventfd, which also makes it safe from any thread.
+    bool m_running;
+    int m_terminateFd;
+    static int terminateCallback(int, uint32_t, void*);
+    static int signalCallback(int, void*);
+
+    std::thread m_startupThread;
+    bool m_startupFailed;
+
+    // ATHOL_OUTPUTS=<name>[,<name>...], the backend's default display
+    // otherwise.
+    std::vector<std::unique_ptr<Output>> m_outputs;
+
+    uint32_t m_renderWidth;
+    uint32_t m_renderHeight;
 
-    uint32_t m_width;
-    uint32_t m_height;
+    // ATHOL_FRAME_REPORT=<seconds> periodically prints the frame rate and
+    // the commit-to-present latency of each output, and the request rates
+    // of the busiest clients.
+    struct wl_event_source* m_reportTimer;
+    int m_reportInterval;
+    static int reportFrames(void*);
 
-    struct RPiBackend {
-        EGLDisplay eglDisplay;
-        DISPMANX_DISPLAY_HANDLE_T displayHandle;
-    } m_backend;
+    FrameStatistics m_statistics;
 
     Input m_input;
+    Cursor m_cursor;
+    Seat m_seat;
 };
 
 #endif // Athol_h
@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Backend.h"
+
+#include "HeadlessBackend.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if ATHOL_BACKEND_RPI
+#include "RPiBackend.h"
+#endif
+
+std::unique_ptr<Backend> Backend::create(const char* output)
+{
+    const char* name = getenv("ATHOL_BACKEND");
+
+#if ATHOL_BACKEND_RPI
+    if (!name || !std::strcmp(name, "rpi"))
+        return std::unique_ptr<Backend>(new RPiBackend(output));
+#endif
+
+    if (!name || !std::strcmp(name, "headless"))
+        return std::unique_ptr<Backend>(new HeadlessBackend);
+
+    std::fprintf(stderr, "[Athol] Unknown backend %s\n", name);
+    return nullptr;
+}
+
+struct CachedBuffer {
+    Backend::BufferInfo info;
+    struct wl_listener destroyListener;
+};
+
+static void destroyCachedBuffer(struct wl_listener* listener, void*)
+{
+    CachedBuffer* cachedBuffer = wl_container_of(listener, cachedBuffer, destroyListener);
+    wl_list_remove(&listener->link);
+    delete cachedBuffer;
+}
+
+const Backend::BufferInfo* Backend::bufferInfo(struct wl_resource* buffer)
+{
+    // The destroy listener doubles as the cache entry.
+    if (struct wl_listener* listener = wl_resource_get_destroy_listener(buffer, destroyCachedBuffer)) {
+        CachedBuffer* cachedBuffer = wl_container_of(listener, cachedBuffer, destroyListener);
+        return &cachedBuffer->info;
+    }
+
+    auto* cachedBuffer = new CachedBuffer;
+    if (!queryBufferInfo(buffer, cachedBuffer->info)) {
+        delete cachedBuffer;
+        return nullptr;
+    }
+
+    cachedBuffer->destroyListener.notify = destroyCachedBuffer;
+    wl_resource_add_destroy_listener(buffer, &cachedBuffer->destroyListener);
+    return &cachedBuffer->info;
+}
+
+std::vector<Backend::Rect> Backend::damagedRows(const std::vector<Rect>& damage, int32_t width, int32_t height)
+{
+    std::vector<Rect> rows;
+    for (auto& rect : damage) {
+        int64_t top = std::max<int64_t>(rect.y, 0);
+        int64_t bottom = std::min<int64_t>(int64_t(rect.y) + rect.height, height);
+        if (top >= bottom || rect.width <= 0 || rect.x >= width || int64_t(rect.x) + rect.width <= 0)
+            continue;
+        rows.push_back({ 0, int32_t(top), width, int32_t(bottom - top) });
+    }
+
+    std::sort(rows.begin(), rows.end(),
+        [](const Rect& a, const Rect& b) { return a.y < b.y; });
+
+    std::vector<Rect> bands;
+    for (auto& row : rows) {
+        if (!bands.empty() && row.y <= bands.back().y + bands.back().height) {
+            auto& band = bands.back();
+            band.height = std::max(band.y + band.height, row.y + row.height) - band.y;
+            continue;
+        }
+        bands.push_back(row);
+    }
+    return bands;
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Backend_h
+#define Backend_h
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <wayland-server.h>
+
+class Backend {
+public:
+    using UpdateHandle = uint32_t;
+    using ElementHandle = uint32_t;
+    using ResourceHandle = uint32_t;
+    static const uint32_t NoHandle = 0;
+
+    struct Rect {
+        int32_t x;
+        int32_t y;
+        int32_t width;
+        int32_t height;
+    };
+
+    // Invoked once per submitted update when the display has picked it up.
+    // Backends may call this from any thread, but always the same one.
+    using CompletionCallback = void (*)(void*);
+
+    // Invoked at every vblank of the display, possibly from another thread.
+    using VblankCallback = void (*)(void*);
+
+    // Picks the backend named by ATHOL_BACKEND, or the first available one,
+    // driving the named display, or the backend's default one if null.
+    static std::unique_ptr<Backend> create(const char* output);
+
+    virtual ~Backend() = default;
+
+    // Brings up the display. Runs on the startup thread while the main loop
+    // is not dispatching yet, so it must not touch the wl_display.
+    virtual bool initialize(CompletionCallback, void*) = 0;
+
+    // Then, on the main thread, adds what the backend exposes to clients.
+    virtual void bindDisplay(struct wl_display*) { }
+
+    virtual uint32_t width() const = 0;
+    virtual uint32_t height() const = 0;
+
+    virtual void setVblankCallback(VblankCallback, void*) = 0;
+
+    virtual UpdateHandle startUpdate() = 0;
+    virtual void submitUpdate(UpdateHandle) = 0;
+
+    virtual ResourceHandle createResource(uint32_t width, uint32_t height, const void* pixels, uint32_t stride) = 0;
+    virtual void deleteResource(ResourceHandle) = 0;
+
+    // Elements show a source of the given size scaled to the destination
+    // rect, in screen coordinates. Opaque elements ignore the alpha channel
+    // of their source and are not blended with what lies below them.
+    virtual ElementHandle addElement(UpdateHandle, int32_t layer, ResourceHandle, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination, bool opaque) = 0;
+    virtual void removeElement(UpdateHandle, ElementHandle) = 0;
+    virtual void changeElementAttributes(UpdateHandle, ElementHandle, int32_t layer, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination) = 0;
+
+    struct BufferInfo {
+        int32_t width;
+        int32_t height;
+        bool shm;
+        uint32_t shmFormat;
+        // What the backend scans out non-shm buffers from.
+        ResourceHandle handle;
+    };
+
+    // Queried once per wl_buffer, and cached until the buffer is destroyed,
+    // so that swapping between the same few buffers never goes through EGL.
+    // Returns null for buffers the backend cannot show.
+    const BufferInfo* bufferInfo(struct wl_resource*);
+
+    // The damage is in buffer coordinates and covers what changed since the
+    // previous buffer attached to the element.
+    virtual void changeElementSource(UpdateHandle, ElementHandle, struct wl_resource* buffer, const std::vector<Rect>& damage) = 0;
+
+    // Bytes of pixel data copied to the display so far.
+    virtual uint64_t uploadedBytes() const = 0;
+
+protected:
+    virtual bool queryBufferInfo(struct wl_resource*, BufferInfo&) = 0;
+
+    // Clips the damage to a buffer of the given size and merges it into
+    // disjoint, full-width bands of rows, sorted from top to bottom.
+    static std::vector<Rect> damagedRows(const std::vector<Rect>& damage, int32_t width, int32_t height);
+};
+
+#endif // Backend_h
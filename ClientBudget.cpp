@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ClientBudget.h"
+
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if WAYLAND_VERSION_MAJOR > 1 || (WAYLAND_VERSION_MAJOR == 1 && WAYLAND_VERSION_MINOR >= 13)
+#define ATHOL_PROTOCOL_LOGGER 1
+#endif
+
+ClientBudget::ClientBudget()
+    : m_serviceSource(nullptr)
+    , m_loop(nullptr)
+    , m_priorityLoop(nullptr)
+    , m_logger(nullptr)
+    , m_budget(100)
+{
+    wl_list_init(&m_clients);
+    wl_list_init(&m_displayDestroyListener.link);
+}
+
+ClientBudget::~ClientBudget()
+{
+    wl_list_remove(&m_displayDestroyListener.link);
+}
+
+#if ATHOL_PROTOCOL_LOGGER
+static void logMessage(void* data, enum wl_protocol_logger_type type, const struct wl_protocol_logger_message* message)
+{
+    if (type == WL_PROTOCOL_LOGGER_REQUEST)
+        static_cast<ClientBudget*>(data)->requestDispatched(wl_resource_get_client(message->resource));
+}
+#endif
+
+bool ClientBudget::initialize(struct wl_display* display, struct wl_event_loop* priorityLoop)
+{
+    m_loop = wl_display_get_event_loop(display);
+    m_priorityLoop = priorityLoop;
+    if (const char* budget = getenv("ATHOL_CLIENT_BUDGET")) {
+        char* end;
+        errno = 0;
+        unsigned long value = std::strtoul(budget, &end, 10);
+        if (end == budget || *end || errno || value > UINT32_MAX || std::strchr(budget, '-'))
+            std::fprintf(stderr, "[Athol] Invalid ATHOL_CLIENT_BUDGET %s, keeping %u\n", budget, m_budget);
+        else
+            m_budget = value;
+    }
+
+#if ATHOL_PROTOCOL_LOGGER
+    m_logger = wl_display_add_protocol_logger(display, logMessage, this);
+    if (!m_logger)
+        return false;
+
+    // The display does not destroy its loggers.
+    m_displayDestroyListener.notify = destroyDisplay;
+    wl_display_add_destroy_listener(display, &m_displayDestroyListener);
+#else
+    std::fprintf(stderr, "[Athol] Client request budgets need libwayland 1.13, requests are not counted.\n");
+#endif
+    return true;
+}
+
+void ClientBudget::destroyDisplay(struct wl_listener* listener, void*)
+{
+#if ATHOL_PROTOCOL_LOGGER
+    ClientBudget* budget = wl_container_of(listener, budget, m_displayDestroyListener);
+    wl_protocol_logger_destroy(budget->m_logger);
+    budget->m_logger = nullptr;
+    if (budget->m_serviceSource)
+        wl_event_source_remove(budget->m_serviceSource);
+    budget->m_serviceSource = nullptr;
+#endif
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+}
+
+void ClientBudget::beginIteration()
+{
+    Client* client;
+    wl_list_for_each(client, &m_clients, link) {
+        client->iterationRequests = 0;
+        client->budgetRequests = 0;
+    }
+}
+
+void ClientBudget::requestDispatched(struct wl_client* wlClient)
+{
+    Client& client = clientFor(wlClient);
+    client.requests++;
+    if (++client.iterationRequests > client.peakIterationRequests)
+        client.peakIterationRequests = client.iterationRequests;
+
+    if (!m_budget || ++client.budgetRequests < m_budget)
+        return;
+
+    // The request is still being dispatched, so the priority sources wait
+    // until the batch it is part of is done.
+    client.budgetRequests = 0;
+    client.overBudget++;
+    if (!m_serviceSource)
+        m_serviceSource = wl_event_loop_add_idle(m_loop, servicePriorityLoop, this);
+}
+
+void ClientBudget::servicePriorityLoop(void* data)
+{
+    ATHOL_TRACE_SCOPE("ClientBudget::servicePriorityLoop");
+    auto& budget = *static_cast<ClientBudget*>(data);
+    // Idle sources are removed once they have run.
+    budget.m_serviceSource = nullptr;
+    wl_event_loop_dispatch(budget.m_priorityLoop, 0);
+
+    Client* client;
+    wl_list_for_each(client, &budget.m_clients, link)
+        client->budgetRequests = 0;
+}
+
+void ClientBudget::destroyClient(struct wl_listener* listener, void*)
+{
+    Client* client = wl_container_of(listener, client, destroyListener);
+    wl_list_remove(&listener->link);
+    wl_list_remove(&client->link);
+    delete client;
+}
+
+ClientBudget::Client& ClientBudget::clientFor(struct wl_client* wlClient)
+{
+    // The destroy listener doubles as the lookup.
+    if (struct wl_listener* listener = wl_client_get_destroy_listener(wlClient, destroyClient)) {
+        Client* client = wl_container_of(listener, client, destroyListener);
+        return *client;
+    }
+
+    Client* client = new Client();
+    client->destroyListener.notify = destroyClient;
+    wl_client_add_destroy_listener(wlClient, &client->destroyListener);
+    wl_list_insert(&m_clients, &client->link);
+    wl_client_get_credentials(wlClient, &client->pid, nullptr, nullptr);
+    return *client;
+}
+
+void ClientBudget::report(int interval)
+{
+    std::vector<Client*> clients;
+    Client* client;
+    wl_list_for_each(client, &m_clients, link) {
+        if (client->requests)
+            clients.push_back(client);
+    }
+
+    static const size_t s_reportedClients = 3;
+    size_t reported = std::min(clients.size(), s_reportedClients);
+    std::partial_sort(clients.begin(), clients.begin() + reported, clients.end(),
+        [](const Client* a, const Client* b) { return a->requests > b->requests; });
+
+    for (size_t i = 0; i < reported; ++i) {
+        std::fprintf(stderr, "[Athol] Client %d: %.0f requests/s, up to %u per iteration, over budget %llu times\n",
+            int(clients[i]->pid), double(clients[i]->requests) / interval, clients[i]->peakIterationRequests,
+            static_cast<unsigned long long>(clients[i]->overBudget));
+    }
+
+    wl_list_for_each(client, &m_clients, link) {
+        client->requests = 0;
+        client->peakIterationRequests = 0;
+        client->overBudget = 0;
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ClientBudget_h
+#define ClientBudget_h
+
+#include <cstdint>
+#include <sys/types.h>
+#include <wayland-server.h>
+
+// Counts the requests of every client, and shortens how long a client that
+// floods the compositor holds back the displays. The budget is a hint for
+// when to service the priority sources early, not a cap on any client:
+// once a client has had ATHOL_CLIENT_BUDGET requests (100 by default, 0 to
+// never service them early) dispatched since the priority sources were last
+// serviced, update completions and repaints are serviced from an idle
+// source, as soon as the clients that woke the event loop along with it
+// have been dispatched. libwayland dispatches everything a client has
+// buffered in one go, and offers no safe place to interrupt that, so a
+// single batch always runs to its end.
+//
+// Needs the protocol logger of libwayland 1.13, without it nothing is
+// counted.
+class ClientBudget {
+public:
+    ClientBudget();
+    ~ClientBudget();
+
+    ClientBudget(const ClientBudget&) = delete;
+    ClientBudget& operator=(const ClientBudget&) = delete;
+
+    bool initialize(struct wl_display*, struct wl_event_loop* priorityLoop);
+
+    // Gives every client a new budget.
+    void beginIteration();
+
+    // Called for every request libwayland dispatches.
+    void requestDispatched(struct wl_client*);
+
+    // Prints the request rates of the busiest clients since the last
+    // report, with ATHOL_FRAME_REPORT.
+    void report(int interval);
+
+private:
+    struct Client {
+        struct wl_listener destroyListener;
+        struct wl_list link;
+        pid_t pid;
+
+        // Requests since the start of the iteration, and since the priority
+        // sources were last serviced.
+        uint32_t iterationRequests;
+        uint32_t budgetRequests;
+
+        // Since the last report.
+        uint64_t requests;
+        uint32_t peakIterationRequests;
+        uint64_t overBudget;
+    };
+    static void destroyClient(struct wl_listener*, void*);
+    Client& clientFor(struct wl_client*);
+
+    static void destroyDisplay(struct wl_listener*, void*);
+    struct wl_listener m_displayDestroyListener;
+
+    static void servicePriorityLoop(void*);
+    struct wl_event_source* m_serviceSource;
+
+    struct wl_event_loop* m_loop;
+    struct wl_event_loop* m_priorityLoop;
+    struct wl_protocol_logger* m_logger;
+    struct wl_list m_clients;
+    // Requests after which the priority sources are serviced early, or 0.
+    uint32_t m_budget;
+};
+
+#endif // ClientBudget_h
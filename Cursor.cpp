@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Cursor.h"
+
+#include "Athol.h"
+#include "Output.h"
+#include "Surface.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// The compositor's arrow, hotspot at the tip. X is black, . white.
+static const char* const s_arrow[] = {
+    "X           ",
+    "XX          ",
+    "X.X         ",
+    "X..X        ",
+    "X...X       ",
+    "X....X      ",
+    "X.....X     ",
+    "X......X    ",
+    "X.......X   ",
+    "X........X  ",
+    "X.........X ",
+    "X......XXXXX",
+    "X...X..X    ",
+    "X..XX..X    ",
+    "X.X  X..X   ",
+    "XX   X..X   ",
+    "X     X..X  ",
+    "      X..X  ",
+    "       XX   ",
+};
+
+Cursor::Cursor(Athol& athol)
+    : m_athol(athol)
+    , m_initialized(false)
+    , m_enabled(false)
+    , m_moved(false)
+    , m_dirty(false)
+    , m_x(0)
+    , m_y(0)
+    , m_surface(nullptr)
+    , m_hotspotX(0)
+    , m_hotspotY(0)
+    , m_width(0)
+    , m_height(0)
+    , m_imageChanged(false)
+    , m_output(nullptr)
+    , m_resource(Backend::NoHandle)
+    , m_element(Backend::NoHandle)
+{
+}
+
+Cursor::~Cursor()
+{
+}
+
+void Cursor::initialize()
+{
+    Output& output = m_athol.output(0);
+    m_x = output.x() + output.width() / 2;
+    m_y = output.height() / 2;
+    m_initialized = true;
+
+    const char* cursor = getenv("ATHOL_CURSOR");
+    m_enabled = !cursor || std::strcmp(cursor, "0");
+    if (m_enabled)
+        setDefaultImage();
+}
+
+void Cursor::moveBy(double dx, double dy)
+{
+    if (!m_initialized)
+        return;
+
+    // Kept within the outputs, which are laid out left to right.
+    Output& last = m_athol.output(m_athol.outputCount() - 1);
+    m_x = std::min(std::max(m_x + dx, 0.0), double(last.x() + int32_t(last.width()) - 1));
+    Output* output = outputAt(int32_t(m_x));
+    m_y = std::min(std::max(m_y + dy, 0.0), double(output->height() - 1));
+
+    m_moved = true;
+    m_dirty = m_enabled;
+}
+
+void Cursor::setSurface(Surface* surface, int32_t hotspotX, int32_t hotspotY)
+{
+    if (!m_enabled)
+        return;
+
+    m_hotspotX = hotspotX;
+    m_hotspotY = hotspotY;
+    m_dirty = true;
+
+    if (surface == m_surface && surface) {
+        flush();
+        return;
+    }
+
+    m_surface = surface;
+    m_pixels.clear();
+    m_width = 0;
+    m_height = 0;
+    m_imageChanged = true;
+    if (surface && surface->buffer())
+        setImage(surface->buffer());
+    flush();
+}
+
+void Cursor::surfaceCommitted(Surface& surface)
+{
+    if (&surface != m_surface)
+        return;
+
+    // Attaching null hides the cursor until the next buffer.
+    if (surface.buffer())
+        setImage(surface.buffer());
+    else {
+        m_pixels.clear();
+        m_width = 0;
+        m_height = 0;
+        m_imageChanged = true;
+    }
+    m_dirty = true;
+    flush();
+}
+
+void Cursor::surfaceDestroyed(Surface& surface)
+{
+    if (&surface != m_surface)
+        return;
+
+    // As if the client had hidden it.
+    m_surface = nullptr;
+    m_pixels.clear();
+    m_width = 0;
+    m_height = 0;
+    m_imageChanged = true;
+    m_dirty = true;
+    flush();
+}
+
+void Cursor::setDefault()
+{
+    if (!m_enabled || (!m_surface && m_width))
+        return;
+
+    m_surface = nullptr;
+    m_hotspotX = 0;
+    m_hotspotY = 0;
+    setDefaultImage();
+    m_dirty = true;
+    flush();
+}
+
+void Cursor::setDefaultImage()
+{
+    m_height = sizeof(s_arrow) / sizeof(s_arrow[0]);
+    m_width = std::strlen(s_arrow[0]);
+    m_pixels.resize(m_width * m_height);
+    for (uint32_t y = 0; y < m_height; ++y) {
+        for (uint32_t x = 0; x < m_width; ++x) {
+            char pixel = s_arrow[y][x];
+            m_pixels[y * m_width + x] = pixel == 'X' ? 0xff000000 : pixel == '.' ? 0xffffffff : 0;
+        }
+    }
+    m_imageChanged = true;
+}
+
+void Cursor::setImage(struct wl_resource* buffer)
+{
+    struct wl_shm_buffer* shmBuffer = wl_shm_buffer_get(buffer);
+    if (!shmBuffer) {
+        std::fprintf(stderr, "[Athol] Cursor surfaces need wl_shm buffers\n");
+        return;
+    }
+
+    uint32_t format = wl_shm_buffer_get_format(shmBuffer);
+    if (format != WL_SHM_FORMAT_ARGB8888 && format != WL_SHM_FORMAT_XRGB8888) {
+        std::fprintf(stderr, "[Athol] Unsupported cursor buffer format %u\n", format);
+        return;
+    }
+
+    int32_t width = wl_shm_buffer_get_width(shmBuffer);
+    int32_t height = wl_shm_buffer_get_height(shmBuffer);
+    int32_t stride = wl_shm_buffer_get_stride(shmBuffer);
+    if (width <= 0 || height <= 0)
+        return;
+
+    m_width = width;
+    m_height = height;
+    m_pixels.resize(m_width * m_height);
+
+    uint32_t alpha = format == WL_SHM_FORMAT_XRGB8888 ? 0xff000000 : 0;
+    wl_shm_buffer_begin_access(shmBuffer);
+    auto* data = static_cast<const uint8_t*>(wl_shm_buffer_get_data(shmBuffer));
+    for (uint32_t y = 0; y < m_height; ++y) {
+        auto* row = reinterpret_cast<const uint32_t*>(data + y * stride);
+        for (uint32_t x = 0; x < m_width; ++x)
+            m_pixels[y * m_width + x] = row[x] | alpha;
+    }
+    wl_shm_buffer_end_access(shmBuffer);
+
+    m_imageChanged = true;
+}
+
+Output* Cursor::outputAt(int32_t x)
+{
+    for (unsigned i = m_athol.outputCount(); i > 0; --i) {
+        Output& output = m_athol.output(i - 1);
+        if (x >= output.x())
+            return &output;
+    }
+    return &m_athol.output(0);
+}
+
+Backend::Rect Cursor::destination() const
+{
+    return { int32_t(m_x) - m_output->x() - m_hotspotX, int32_t(m_y) - m_hotspotY, int32_t(m_width), int32_t(m_height) };
+}
+
+void Cursor::flush()
+{
+    if (!m_dirty)
+        return;
+    m_dirty = false;
+
+    ATHOL_TRACE_SCOPE("Cursor::flush");
+    deleteRetiredResources(false);
+
+    Output* output = m_moved && m_width && m_height ? outputAt(int32_t(m_x)) : nullptr;
+    if (m_element != Backend::NoHandle && (output != m_output || m_imageChanged))
+        removeElement(m_output->frameUpdate());
+    m_imageChanged = false;
+    if (!output)
+        return;
+
+    // Goes with the next frame of the output, which the frame clock submits
+    // at the next vblank even if no client has anything to show.
+    m_output = output;
+    Output::Update& update = output->frameUpdate();
+    Backend& backend = update.backend();
+    if (m_element == Backend::NoHandle) {
+        m_resource = backend.createResource(m_width, m_height, m_pixels.data(), m_width * sizeof(uint32_t));
+        m_element = backend.addElement(update.handle(), s_layer, m_resource, m_width, m_height, destination(), false);
+    } else
+        backend.changeElementAttributes(update.handle(), m_element, s_layer, m_width, m_height, destination());
+}
+
+void Cursor::removeElement(Output::Update& update)
+{
+    update.backend().removeElement(update.handle(), m_element);
+    m_retiredResources.push_back({ m_output, m_resource, update.serial() });
+    m_element = Backend::NoHandle;
+    m_resource = Backend::NoHandle;
+}
+
+void Cursor::hide()
+{
+    // Nothing repaints any more, so the removal is submitted right away.
+    if (m_element != Backend::NoHandle)
+        removeElement(*m_output->takeUpdate());
+    m_moved = false;
+    deleteRetiredResources(true);
+}
+
+void Cursor::deleteRetiredResources(bool all)
+{
+    auto end = std::remove_if(m_retiredResources.begin(), m_retiredResources.end(),
+        [all](const RetiredResource& retired) {
+            if (!all && retired.output->completedUpdates() < retired.update)
+                return false;
+            retired.output->backend().deleteResource(retired.resource);
+            return true;
+        });
+    m_retiredResources.erase(end, m_retiredResources.end());
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Cursor_h
+#define Cursor_h
+
+#include "Backend.h"
+#include "Output.h"
+#include <cstdint>
+#include <vector>
+#include <wayland-server.h>
+
+class Athol;
+class Surface;
+
+// The pointer, drawn by the compositor on an element of its own above every
+// surface. Motion moves the element in the next frame's update, which the
+// frame clock submits at the next vblank, so the cursor keeps up with the
+// mouse whatever the frame rate of the clients, and never makes them
+// repaint.
+class Cursor {
+public:
+    Cursor(Athol&);
+    ~Cursor();
+
+    Cursor(const Cursor&) = delete;
+    Cursor& operator=(const Cursor&) = delete;
+
+    // Once the outputs are up. ATHOL_CURSOR=0 leaves drawing the pointer to
+    // the shell, the position is tracked either way.
+    void initialize();
+
+    // The position in the space the outputs are laid out in, starting at
+    // the center of the first output, and the output it is on.
+    double x() const { return m_x; }
+    double y() const { return m_y; }
+    Output* output() { return outputAt(int32_t(m_x)); }
+
+    // The cursor shows from the first motion on. Motion accumulates until
+    // flush(), which input calls after each batch of events.
+    void moveBy(double dx, double dy);
+    void flush();
+
+    // Shows the buffers the surface commits, with the hotspot at the
+    // pointer, or hides the cursor for a null surface. Cursor surfaces need
+    // wl_shm buffers, which are copied on commit.
+    void setSurface(Surface*, int32_t hotspotX, int32_t hotspotY);
+    void surfaceCommitted(Surface&);
+    void surfaceDestroyed(Surface&);
+
+    // Goes back to the compositor's arrow.
+    void setDefault();
+
+    // Removes the element and frees its resources, before the outputs go.
+    void hide();
+
+private:
+    Athol& m_athol;
+    bool m_initialized;
+    bool m_enabled;
+    bool m_moved;
+    bool m_dirty;
+    double m_x;
+    double m_y;
+
+    Surface* m_surface;
+    int32_t m_hotspotX;
+    int32_t m_hotspotY;
+
+    // The image, premultiplied ARGB8888, kept to create the resource again
+    // on whichever output the cursor moves to.
+    void setDefaultImage();
+    void setImage(struct wl_resource* buffer);
+    std::vector<uint32_t> m_pixels;
+    uint32_t m_width;
+    uint32_t m_height;
+    bool m_imageChanged;
+
+    Output* outputAt(int32_t x);
+    Backend::Rect destination() const;
+    static const int32_t s_layer = INT32_MAX;
+
+    Output* m_output;
+    Backend::ResourceHandle m_resource;
+    Backend::ElementHandle m_element;
+    void removeElement(Output::Update&);
+
+    // Resources taken off the screen, deleted once the update that removed
+    // their element completes.
+    struct RetiredResource {
+        Output* output;
+        Backend::ResourceHandle resource;
+        uint64_t update;
+    };
+    std::vector<RetiredResource> m_retiredResources;
+    void deleteRetiredResources(bool all);
+};
+
+#endif // Cursor_h
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FrameClock.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+static const uint64_t s_defaultRefreshInterval = 1000000000 / 60;
+static const uint64_t s_defaultRepaintWindow = 7000000;
+
+FrameClock::FrameClock()
+    : m_eventLoop(nullptr)
+    , m_repaintFunction(nullptr)
+    , m_repaintData(nullptr)
+    , m_timerfd(-1)
+    , m_timerSource(nullptr)
+    , m_repaintScheduled(false)
+    , m_inhibited(false)
+    , m_repaintWindow(s_defaultRepaintWindow)
+    , m_lastVblank(0)
+    , m_refreshInterval(s_defaultRefreshInterval)
+    , m_vblankCount(0)
+    , m_vblankWrites(0)
+{
+}
+
+FrameClock::~FrameClock()
+{
+    if (m_timerfd != -1)
+        close(m_timerfd);
+}
+
+bool FrameClock::initialize(struct wl_event_loop* eventLoop, RepaintFunction function, void* data)
+{
+    m_eventLoop = eventLoop;
+    m_repaintFunction = function;
+    m_repaintData = data;
+
+    // ATHOL_REPAINT_WINDOW=<milliseconds before vblank>
+    if (const char* window = getenv("ATHOL_REPAINT_WINDOW")) {
+        double milliseconds = std::atof(window);
+        if (milliseconds >= 0)
+            m_repaintWindow = uint64_t(milliseconds * 1000000);
+    }
+
+    m_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (m_timerfd == -1)
+        return false;
+
+    m_timerSource = wl_event_loop_add_fd(m_eventLoop, m_timerfd, WL_EVENT_READABLE, timerCallback, this);
+    return !!m_timerSource;
+}
+
+uint64_t FrameClock::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+void FrameClock::vblank(void* data)
+{
+    auto& clock = *static_cast<FrameClock*>(data);
+    uint64_t time = now();
+    clock.m_vblankWrites++;
+    clock.m_vblankCount++;
+    uint64_t last = clock.m_lastVblank.exchange(time);
+    clock.m_vblankWrites++;
+
+    // Smooth out the jitter of the thread delivering vblanks.
+    if (last && time > last) {
+        uint64_t interval = time - last;
+        uint64_t refreshInterval = clock.m_refreshInterval;
+        if (interval > refreshInterval / 2 && interval < refreshInterval * 3 / 2)
+            clock.m_refreshInterval = (refreshInterval * 7 + interval) / 8;
+    }
+}
+
+void FrameClock::lastVblank(uint64_t& time, uint64_t& count) const
+{
+    uint64_t writes;
+    do {
+        writes = m_vblankWrites;
+        count = m_vblankCount;
+        time = m_lastVblank;
+    } while ((writes & 1) || writes != m_vblankWrites);
+}
+
+void FrameClock::scheduleRepaint()
+{
+    if (m_repaintScheduled)
+        return;
+    m_repaintScheduled = true;
+    if (m_inhibited)
+        return;
+
+    uint64_t time = now();
+    uint64_t deadline = nextDeadline(time);
+    if (deadline <= time || m_timerfd == -1) {
+        wl_event_loop_add_idle(m_eventLoop, idleCallback, this);
+        return;
+    }
+
+    struct itimerspec spec = { };
+    spec.it_value.tv_sec = deadline / 1000000000;
+    spec.it_value.tv_nsec = deadline % 1000000000;
+    timerfd_settime(m_timerfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void FrameClock::setInhibited(bool inhibited)
+{
+    if (inhibited == m_inhibited)
+        return;
+    m_inhibited = inhibited;
+
+    if (inhibited) {
+        struct itimerspec spec = { };
+        timerfd_settime(m_timerfd, 0, &spec, nullptr);
+        return;
+    }
+
+    if (m_repaintScheduled) {
+        m_repaintScheduled = false;
+        scheduleRepaint();
+    }
+}
+
+uint64_t FrameClock::nextDeadline(uint64_t time) const
+{
+    uint64_t lastVblank = m_lastVblank;
+    uint64_t interval = m_refreshInterval;
+    if (!lastVblank || !interval)
+        return time;
+
+    // Repaint in the window before the first vblank we can still make.
+    uint64_t vblank = lastVblank + interval;
+    if (vblank <= time)
+        vblank += ((time - vblank) / interval + 1) * interval;
+
+    uint64_t deadline = vblank > m_repaintWindow ? vblank - m_repaintWindow : 0;
+    if (deadline < time)
+        deadline += interval;
+    return deadline;
+}
+
+int FrameClock::timerCallback(int fd, uint32_t, void* data)
+{
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return 0;
+
+    static_cast<FrameClock*>(data)->repaint();
+    return 0;
+}
+
+void FrameClock::idleCallback(void* data)
+{
+    static_cast<FrameClock*>(data)->repaint();
+}
+
+void FrameClock::repaint()
+{
+    if (!m_repaintScheduled || m_inhibited)
+        return;
+    m_repaintScheduled = false;
+
+    m_repaintFunction(m_repaintData);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FrameClock_h
+#define FrameClock_h
+
+#include <atomic>
+#include <cstdint>
+#include <wayland-server.h>
+
+// Schedules repaints a configurable time before the next vblank, like
+// Weston's repaint window, so that every commit arriving before that
+// deadline makes it into the same frame. Without vblank information it
+// falls back to repainting as soon as the event loop is idle.
+class FrameClock {
+public:
+    using RepaintFunction = void (*)(void*);
+
+    FrameClock();
+    ~FrameClock();
+
+    FrameClock(const FrameClock&) = delete;
+    FrameClock& operator=(const FrameClock&) = delete;
+
+    bool initialize(struct wl_event_loop*, RepaintFunction, void*);
+
+    // CLOCK_MONOTONIC, in nanoseconds.
+    static uint64_t now();
+
+    // Safe to call from any thread.
+    static void vblank(void*);
+
+    void scheduleRepaint();
+    bool isRepaintScheduled() const { return m_repaintScheduled; }
+
+    // An inhibited clock only remembers that a repaint is wanted, and
+    // schedules it once released. The benchmarks in bench/ inhibit it to
+    // drive repaints by hand.
+    void setInhibited(bool);
+
+    uint64_t refreshInterval() const { return m_refreshInterval; }
+    uint64_t vblankCount() const { return m_vblankCount; }
+
+    // The time and count of the latest vblank, read together from any
+    // thread. The time is zero until the first vblank.
+    void lastVblank(uint64_t& time, uint64_t& count) const;
+
+private:
+    static int timerCallback(int, uint32_t, void*);
+    static void idleCallback(void*);
+    void repaint();
+
+    uint64_t nextDeadline(uint64_t now) const;
+
+    struct wl_event_loop* m_eventLoop;
+    RepaintFunction m_repaintFunction;
+    void* m_repaintData;
+
+    int m_timerfd;
+    struct wl_event_source* m_timerSource;
+    bool m_repaintScheduled;
+    bool m_inhibited;
+
+    uint64_t m_repaintWindow;
+    std::atomic<uint64_t> m_lastVblank;
+    std::atomic<uint64_t> m_refreshInterval;
+    std::atomic<uint64_t> m_vblankCount;
+    // Odd while vblank() updates the time and the count.
+    std::atomic<uint64_t> m_vblankWrites;
+};
+
+#endif // FrameClock_h
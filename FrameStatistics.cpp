@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "FrameStatistics.h"
+
+#include "FrameClock.h"
+#include "Surface.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+FrameStatistics::Histogram::Histogram()
+    : m_count(0)
+    , m_max(0)
+{
+    for (auto& bucket : m_buckets)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+unsigned FrameStatistics::Histogram::bucketFor(uint64_t value)
+{
+    if (value < 4)
+        return value;
+
+    // The exponent picks a group of four buckets, the two bits below the
+    // leading one pick the bucket within it.
+    unsigned exponent = 63 - __builtin_clzll(value);
+    unsigned mantissa = (value >> (exponent - 2)) & 3;
+    return (exponent - 1) * 4 + mantissa;
+}
+
+uint64_t FrameStatistics::Histogram::bucketUpperBound(unsigned bucket)
+{
+    if (bucket < 4)
+        return bucket;
+
+    unsigned exponent = bucket / 4 + 1;
+    uint64_t mantissa = 4 + bucket % 4;
+    if (exponent == 63 && mantissa == 7)
+        return UINT64_MAX;
+    return ((mantissa + 1) << (exponent - 2)) - 1;
+}
+
+void FrameStatistics::Histogram::record(uint64_t value)
+{
+    m_buckets[bucketFor(value)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t max = m_max.load(std::memory_order_relaxed);
+    while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) { }
+}
+
+uint64_t FrameStatistics::Histogram::percentile(double fraction) const
+{
+    uint64_t count = this->count();
+    if (!count)
+        return 0;
+
+    uint64_t target = std::max<uint64_t>(1, std::ceil(fraction * count));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < s_bucketCount; ++i) {
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+            return std::min(bucketUpperBound(i), max());
+    }
+    return max();
+}
+
+FrameStatistics::FrameStatistics()
+    : m_startTime(0)
+    , m_frames(0)
+    , m_missedVblanks(0)
+    , m_socket(-1)
+{
+    std::memset(m_submittedUpdates, 0, sizeof(m_submittedUpdates));
+}
+
+FrameStatistics::~FrameStatistics()
+{
+    if (m_socket == -1)
+        return;
+
+    close(m_socket);
+    unlink(m_socketPath.c_str());
+}
+
+bool FrameStatistics::initialize(struct wl_event_loop* loop)
+{
+    m_startTime = FrameClock::now();
+
+    if (!wl_event_loop_add_signal(loop, SIGUSR1, signalCallback, this))
+        return false;
+
+    const char* path = getenv("ATHOL_STATS_SOCKET");
+    if (!path || !*path)
+        return true;
+
+    struct sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (std::strlen(path) >= sizeof(address.sun_path)) {
+        std::fprintf(stderr, "[Athol] Statistics socket path too long: %s\n", path);
+        return false;
+    }
+    std::strcpy(address.sun_path, path);
+
+    m_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (m_socket == -1)
+        return false;
+
+    unlink(path);
+    if (bind(m_socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == -1
+        || listen(m_socket, 4) == -1) {
+        std::fprintf(stderr, "[Athol] Cannot listen on statistics socket %s: %s\n", path, std::strerror(errno));
+        close(m_socket);
+        m_socket = -1;
+        return false;
+    }
+    m_socketPath = path;
+
+    return wl_event_loop_add_fd(loop, m_socket, WL_EVENT_READABLE, acceptCallback, this);
+}
+
+void FrameStatistics::addOutput(const struct wl_list* surfaceList)
+{
+    m_surfaceLists.push_back(surfaceList);
+}
+
+void FrameStatistics::repainted(uint64_t commitTime, uint64_t repaintTime)
+{
+    m_commitToRepaint.record(repaintTime - commitTime);
+}
+
+void FrameStatistics::submitted(unsigned output, uint64_t update, uint64_t repaintTime, uint64_t submitTime, uint64_t vblank)
+{
+    m_repaintToSubmit.record(submitTime - repaintTime);
+    m_submittedUpdates[output % s_maxOutputs][update % s_maxSubmittedUpdates] = { update, submitTime, vblank };
+}
+
+void FrameStatistics::completed(unsigned output, uint64_t update, uint64_t completeTime, uint64_t vblank)
+{
+    m_frames.fetch_add(1, std::memory_order_relaxed);
+
+    auto& submitted = m_submittedUpdates[output % s_maxOutputs][update % s_maxSubmittedUpdates];
+    if (submitted.update != update)
+        return;
+
+    m_submitToComplete.record(completeTime - submitted.submitTime);
+
+    // An update submitted between two vblanks should be picked up by the
+    // second one; every vblank after that is a frame we missed.
+    uint64_t expected = submitted.vblank + 1;
+    if (vblank > expected)
+        m_missedVblanks.fetch_add(vblank - expected, std::memory_order_relaxed);
+}
+
+static void appendHistogram(std::string& out, const char* name, const FrameStatistics::Histogram& histogram)
+{
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), "\"%s\":{\"count\":%llu,\"p50\":%llu,\"p99\":%llu,\"max\":%llu},",
+        name, (unsigned long long)histogram.count(), (unsigned long long)histogram.percentile(0.5),
+        (unsigned long long)histogram.percentile(0.99), (unsigned long long)histogram.max());
+    out += buffer;
+}
+
+std::string FrameStatistics::snapshot() const
+{
+    uint64_t now = FrameClock::now();
+
+    // Durations are in nanoseconds.
+    std::string out;
+    char buffer[256];
+    std::snprintf(buffer, sizeof(buffer), "{\"uptime\":%llu,\"frames\":%llu,\"missedVblanks\":%llu,",
+        (unsigned long long)(now - m_startTime), (unsigned long long)m_frames.load(std::memory_order_relaxed),
+        (unsigned long long)m_missedVblanks.load(std::memory_order_relaxed));
+    out += buffer;
+
+    appendHistogram(out, "commitToRepaint", m_commitToRepaint);
+    appendHistogram(out, "repaintToSubmit", m_repaintToSubmit);
+    appendHistogram(out, "submitToComplete", m_submitToComplete);
+
+    out += "\"surfaces\":[";
+    bool first = true;
+    for (unsigned output = 0; output < m_surfaceLists.size(); ++output) {
+        Surface* surface;
+        wl_list_for_each(surface, m_surfaceLists[output], stackLink) {
+            const auto& statistics = surface->statistics;
+            double lifetime = double(now - statistics.created) / 1000000000;
+            std::snprintf(buffer, sizeof(buffer), "%s{\"output\":%u,\"client\":%d,\"id\":%u,\"commits\":%llu,\"commitsPerSecond\":%.2f}",
+                first ? "" : ",", output, int(statistics.client), statistics.id, (unsigned long long)statistics.commits,
+                lifetime > 0 ? statistics.commits / lifetime : 0.0);
+            out += buffer;
+            first = false;
+        }
+    }
+    out += "]}\n";
+
+    return out;
+}
+
+int FrameStatistics::signalCallback(int, void* data)
+{
+    auto& statistics = *static_cast<FrameStatistics*>(data);
+    std::string snapshot = statistics.snapshot();
+    std::fprintf(stderr, "[Athol] %s", snapshot.c_str());
+    return 0;
+}
+
+int FrameStatistics::acceptCallback(int fd, uint32_t mask, void* data)
+{
+    if (mask != WL_EVENT_READABLE)
+        return 0;
+
+    auto& statistics = *static_cast<FrameStatistics*>(data);
+    int client = accept4(fd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (client == -1)
+        return 0;
+
+    // The snapshot fits in the socket buffer, so a reader that is slow to
+    // drain it cannot stall the compositor.
+    std::string snapshot = statistics.snapshot();
+    if (send(client, snapshot.data(), snapshot.size(), MSG_NOSIGNAL) != ssize_t(snapshot.size()))
+        std::fprintf(stderr, "[Athol] Short write on statistics socket\n");
+    close(client);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef FrameStatistics_h
+#define FrameStatistics_h
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <wayland-server.h>
+
+// Frame timing statistics, kept in fixed-size histograms that never
+// allocate. A JSON snapshot is written to stderr on SIGUSR1, and to every
+// connection on the UNIX socket named by ATHOL_STATS_SOCKET.
+class FrameStatistics {
+public:
+    // Log-linear buckets, four per power of two, covering any nanosecond
+    // duration with a relative error below 25%.
+    class Histogram {
+    public:
+        Histogram();
+
+        void record(uint64_t value);
+
+        uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+        uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+        uint64_t percentile(double) const;
+
+    private:
+        static const unsigned s_bucketCount = 256;
+        static unsigned bucketFor(uint64_t);
+        static uint64_t bucketUpperBound(unsigned);
+
+        std::atomic<uint32_t> m_buckets[s_bucketCount];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_max;
+    };
+
+    FrameStatistics();
+    ~FrameStatistics();
+
+    FrameStatistics(const FrameStatistics&) = delete;
+    FrameStatistics& operator=(const FrameStatistics&) = delete;
+
+    // Must run before any other thread is started, so that they all keep
+    // SIGUSR1 blocked.
+    bool initialize(struct wl_event_loop*);
+
+    // Per-surface commit rates are read from the surfaces in the stack list
+    // of each output, in the order outputs are added.
+    void addOutput(const struct wl_list* surfaceList);
+
+    // Update serials are counted separately on each output.
+    void repainted(uint64_t commitTime, uint64_t repaintTime);
+    void submitted(unsigned output, uint64_t update, uint64_t repaintTime, uint64_t submitTime, uint64_t vblank);
+    void completed(unsigned output, uint64_t update, uint64_t completeTime, uint64_t vblank);
+
+    std::string snapshot() const;
+
+private:
+    static int signalCallback(int, void*);
+    static int acceptCallback(int, uint32_t, void*);
+
+    std::vector<const struct wl_list*> m_surfaceLists;
+    uint64_t m_startTime;
+
+    Histogram m_commitToRepaint;
+    Histogram m_repaintToSubmit;
+    Histogram m_submitToComplete;
+    std::atomic<uint64_t> m_frames;
+    std::atomic<uint64_t> m_missedVblanks;
+
+    // Updates still in flight, indexed by output and serial.
+    struct SubmittedUpdate {
+        uint64_t update;
+        uint64_t submitTime;
+        uint64_t vblank;
+    };
+    static const unsigned s_maxOutputs = 4;
+    static const unsigned s_maxSubmittedUpdates = 8;
+    SubmittedUpdate m_submittedUpdates[s_maxOutputs][s_maxSubmittedUpdates];
+
+    std::string m_socketPath;
+    int m_socket;
+};
+
+#endif // FrameStatistics_h
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "HeadlessBackend.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+HeadlessBackend::HeadlessBackend()
+    : m_completionCallback(nullptr)
+    , m_completionData(nullptr)
+    , m_vblankCallback(nullptr)
+    , m_vblankData(nullptr)
+    , m_width(1920)
+    , m_height(1080)
+    , m_vblankInterval(1000000 / 60)
+    , m_nextHandle(NoHandle + 1)
+    , m_uploadedBytes(0)
+    , m_running(false)
+    , m_submittedUpdates(0)
+{
+}
+
+HeadlessBackend::~HeadlessBackend()
+{
+    if (!m_vblankThread.joinable())
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+    m_condition.notify_one();
+    m_vblankThread.join();
+}
+
+bool HeadlessBackend::initialize(CompletionCallback callback, void* data)
+{
+    m_completionCallback = callback;
+    m_completionData = data;
+
+    // ATHOL_HEADLESS_SIZE=<width>x<height>, ATHOL_HEADLESS_REFRESH=<Hz>
+    if (const char* size = getenv("ATHOL_HEADLESS_SIZE")) {
+        unsigned width, height;
+        if (std::sscanf(size, "%ux%u", &width, &height) == 2 && width && height) {
+            m_width = width;
+            m_height = height;
+        }
+    }
+
+    if (const char* refresh = getenv("ATHOL_HEADLESS_REFRESH")) {
+        int rate = std::atoi(refresh);
+        if (rate > 0)
+            m_vblankInterval = std::chrono::microseconds(1000000 / rate);
+    }
+
+    m_running = true;
+    m_vblankThread = std::thread(&HeadlessBackend::vblankLoop, this);
+
+    std::fprintf(stderr, "[Athol] Headless backend %ux%u, vblank every %lld us\n",
+        m_width, m_height, static_cast<long long>(m_vblankInterval.count()));
+    return true;
+}
+
+void HeadlessBackend::setVblankCallback(VblankCallback callback, void* data)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_vblankCallback = callback;
+    m_vblankData = data;
+}
+
+Backend::UpdateHandle HeadlessBackend::startUpdate()
+{
+    return m_nextHandle++;
+}
+
+void HeadlessBackend::submitUpdate(UpdateHandle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_submittedUpdates;
+}
+
+Backend::ResourceHandle HeadlessBackend::createResource(uint32_t, uint32_t, const void*, uint32_t)
+{
+    return m_nextHandle++;
+}
+
+void HeadlessBackend::deleteResource(ResourceHandle)
+{
+}
+
+Backend::ElementHandle HeadlessBackend::addElement(UpdateHandle, int32_t, ResourceHandle, uint32_t, uint32_t, const Rect&, bool)
+{
+    return m_nextHandle++;
+}
+
+void HeadlessBackend::removeElement(UpdateHandle, ElementHandle)
+{
+}
+
+void HeadlessBackend::changeElementAttributes(UpdateHandle, ElementHandle, int32_t, uint32_t, uint32_t, const Rect&)
+{
+}
+
+bool HeadlessBackend::queryBufferInfo(struct wl_resource* buffer, BufferInfo& info)
+{
+    // Buffers we cannot inspect are assumed to cover the whole screen.
+    struct wl_shm_buffer* shmBuffer = wl_shm_buffer_get(buffer);
+    info.width = shmBuffer ? wl_shm_buffer_get_width(shmBuffer) : m_width;
+    info.height = shmBuffer ? wl_shm_buffer_get_height(shmBuffer) : m_height;
+    info.shm = !!shmBuffer;
+    info.shmFormat = shmBuffer ? wl_shm_buffer_get_format(shmBuffer) : 0;
+    info.handle = NoHandle;
+    return true;
+}
+
+void HeadlessBackend::changeElementSource(UpdateHandle, ElementHandle, struct wl_resource* buffer, const std::vector<Rect>& damage)
+{
+    // Account for what an upload of this buffer would cost on real hardware.
+    struct wl_shm_buffer* shmBuffer = wl_shm_buffer_get(buffer);
+    if (!shmBuffer)
+        return;
+
+    int32_t stride = wl_shm_buffer_get_stride(shmBuffer);
+    for (auto& band : damagedRows(damage, wl_shm_buffer_get_width(shmBuffer), wl_shm_buffer_get_height(shmBuffer)))
+        m_uploadedBytes += uint64_t(stride) * band.height;
+}
+
+void HeadlessBackend::vblankLoop()
+{
+    auto vblank = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        vblank += m_vblankInterval;
+        if (m_condition.wait_until(lock, vblank, [this] { return !m_running; }))
+            break;
+
+        // Every update submitted before this vblank got scanned out by it.
+        unsigned completed = m_submittedUpdates;
+        m_submittedUpdates = 0;
+        VblankCallback vblankCallback = m_vblankCallback;
+        void* vblankData = m_vblankData;
+
+        lock.unlock();
+        if (vblankCallback)
+            vblankCallback(vblankData);
+        while (completed--)
+            m_completionCallback(m_completionData);
+        lock.lock();
+    }
+}
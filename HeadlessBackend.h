@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef HeadlessBackend_h
+#define HeadlessBackend_h
+
+#include "Backend.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Scans out into nothing on a fixed vblank timer. Useful to run the
+// compositor, and measure its frame throughput, on a machine without
+// a VideoCore.
+class HeadlessBackend final : public Backend {
+public:
+    HeadlessBackend();
+    virtual ~HeadlessBackend();
+
+    virtual bool initialize(CompletionCallback, void*) override;
+
+    virtual uint32_t width() const override { return m_width; }
+    virtual uint32_t height() const override { return m_height; }
+
+    virtual void setVblankCallback(VblankCallback, void*) override;
+
+    virtual UpdateHandle startUpdate() override;
+    virtual void submitUpdate(UpdateHandle) override;
+
+    virtual ResourceHandle createResource(uint32_t width, uint32_t height, const void* pixels, uint32_t stride) override;
+    virtual void deleteResource(ResourceHandle) override;
+
+    virtual ElementHandle addElement(UpdateHandle, int32_t layer, ResourceHandle, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination, bool opaque) override;
+    virtual void removeElement(UpdateHandle, ElementHandle) override;
+    virtual void changeElementAttributes(UpdateHandle, ElementHandle, int32_t layer, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination) override;
+
+    virtual void changeElementSource(UpdateHandle, ElementHandle, struct wl_resource* buffer, const std::vector<Rect>& damage) override;
+
+    virtual uint64_t uploadedBytes() const override { return m_uploadedBytes; }
+
+private:
+    virtual bool queryBufferInfo(struct wl_resource*, BufferInfo&) override;
+
+    void vblankLoop();
+
+    CompletionCallback m_completionCallback;
+    void* m_completionData;
+
+    VblankCallback m_vblankCallback;
+    void* m_vblankData;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    std::chrono::microseconds m_vblankInterval;
+
+    uint32_t m_nextHandle;
+    uint64_t m_uploadedBytes;
+
+    std::thread m_vblankThread;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_running;
+    unsigned m_submittedUpdates;
+};
+
+#endif // HeadlessBackend_h
@@ -28,39 +28,153 @@
 #include "Input.h"
 
 #include "Athol.h"
+#include "Startup.h"
+#include "Trace.h"
+#include <cerrno>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 
-void Input::initialize(const Athol& athol, std::unique_ptr<API::InputClient> client)
+Input::Input()
+    : m_startupFd(-1)
+    , m_startupSource(nullptr)
+    , m_initialized(false)
+    , m_threadWakeFd(-1)
+    , m_threadStopFd(-1)
+    , m_athol(nullptr)
+    , m_coalesce(false)
+    , m_udev(nullptr)
+    , m_libinput(nullptr)
+    , m_eventSource(nullptr)
+{
+}
+
+void Input::initialize(Athol& athol, std::unique_ptr<API::InputClient> client)
 {
     if (!client) {
         std::fprintf(stderr, "[Athol] No input client provided.\n");
         return;
     }
 
-    m_udev = udev_new();
-    if (!m_udev) {
-        std::fprintf(stderr, "[Athol] Failed to create UDev context.\n");
+    m_athol = &athol;
+    const char* coalesce = getenv("ATHOL_INPUT_COALESCE");
+    m_coalesce = coalesce && !std::strcmp(coalesce, "1");
+    if (m_coalesce)
+        m_events.reserve(64);
+
+    // Enumerating the seat's devices takes a while, the compositor does not
+    // wait for it. The thread wakes the main loop once it is done.
+    m_startupFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_startupFd == -1) {
+        std::fprintf(stderr, "[Athol] Failed to create an eventfd for input startup.\n");
         return;
     }
+    m_startupSource = wl_event_loop_add_fd(wl_display_get_event_loop(athol.display()),
+        m_startupFd, WL_EVENT_READABLE, finishInitialize, this);
 
-    m_libinput = libinput_udev_create_context(&m_interface, nullptr, m_udev);
-    if (!m_libinput) {
-        std::fprintf(stderr, "[Athol] Failed to create libinput context.\n");
-        return;
+    m_client = std::move(client);
+    m_startupThread = std::thread(&Input::initializeSeat, this);
+}
+
+void Input::initializeSeat()
+{
+    m_libinput = nullptr;
+    {
+        Startup::Phase phase("input seat");
+        m_udev = udev_new();
+        if (!m_udev)
+            std::fprintf(stderr, "[Athol] Failed to create UDev context.\n");
+        else if (!(m_libinput = libinput_udev_create_context(&m_interface, nullptr, m_udev)))
+            std::fprintf(stderr, "[Athol] Failed to create libinput context.\n");
+        else if (libinput_udev_assign_seat(m_libinput, "seat0")) {
+            std::fprintf(stderr, "[Athol] Failed to assign a seat for libinput.\n");
+            libinput_unref(m_libinput);
+            m_libinput = nullptr;
+        }
     }
 
-    if (libinput_udev_assign_seat(m_libinput, "seat0")) {
-        std::fprintf(stderr, "[Athol] Failed to assign a seat for libinput.\n");
+    uint64_t value = 1;
+    if (write(m_startupFd, &value, sizeof(value)) != sizeof(value))
+        std::fprintf(stderr, "[Athol] Failed to signal the end of input startup\n");
+}
+
+int Input::finishInitialize(int, uint32_t, void* data)
+{
+    auto& input = *static_cast<Input*>(data);
+    input.m_startupThread.join();
+    wl_event_source_remove(input.m_startupSource);
+    input.m_startupSource = nullptr;
+    close(input.m_startupFd);
+    input.m_startupFd = -1;
+
+    if (!input.m_libinput)
+        return 0;
+
+    input.processEvents();
+
+    struct wl_event_loop* loop = wl_display_get_event_loop(input.m_athol->display());
+    const char* thread = getenv("ATHOL_INPUT_THREAD");
+    if (thread && !std::strcmp(thread, "1")) {
+        if (!input.startThread(loop))
+            return 0;
+    } else
+        input.m_eventSource = wl_event_loop_add_fd(loop, libinput_get_fd(input.m_libinput), WL_EVENT_READABLE, dispatch, &input);
+
+    input.m_initialized = true;
+    std::fprintf(stderr, "[Athol] Input initialized.\n");
+    return 0;
+}
+
+Input::~Input()
+{
+    if (m_startupThread.joinable())
+        m_startupThread.join();
+    if (m_startupFd != -1)
+        close(m_startupFd);
+
+    if (!m_thread.joinable())
         return;
+
+    uint64_t value = 1;
+    if (write(m_threadStopFd, &value, sizeof(value)) != sizeof(value))
+        std::fprintf(stderr, "[Athol] Failed to stop the input thread\n");
+    m_thread.join();
+
+    close(m_threadStopFd);
+    close(m_threadWakeFd);
+}
+
+bool Input::startThread(struct wl_event_loop* loop)
+{
+    m_threadWakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_threadStopFd = eventfd(0, EFD_CLOEXEC);
+    if (m_threadWakeFd == -1 || m_threadStopFd == -1) {
+        std::fprintf(stderr, "[Athol] Failed to create eventfds for the input thread.\n");
+        return false;
     }
 
-    m_eventSource = wl_event_loop_add_fd(wl_display_get_event_loop(athol.display()),
-        libinput_get_fd(m_libinput), WL_EVENT_READABLE, dispatch, this);
-    m_client = std::move(client);
+    m_eventSource = wl_event_loop_add_fd(loop, m_threadWakeFd, WL_EVENT_READABLE, drainThreadQueue, this);
 
-    std::fprintf(stderr, "[Athol] Input initialized.\n");
-    processEvents();
+    // From here on libinput is only ever touched by the input thread.
+    m_thread = std::thread(&Input::threadLoop, this);
+
+    // ATHOL_INPUT_THREAD_PRIORITY=<1-99> runs the thread with SCHED_FIFO,
+    // so that it preempts the compositor and its clients.
+    if (const char* priority = getenv("ATHOL_INPUT_THREAD_PRIORITY")) {
+        struct sched_param param;
+        param.sched_priority = std::atoi(priority);
+        int error = pthread_setschedparam(m_thread.native_handle(), SCHED_FIFO, &param);
+        if (error)
+            std::fprintf(stderr, "[Athol] Failed to raise the input thread priority: %s\n", std::strerror(error));
+    }
+
+    return true;
 }
 
 struct libinput_interface Input::m_interface = {
@@ -78,6 +192,7 @@ struct libinput_interface Input::m_interface = {
 
 int Input::dispatch(int, uint32_t, void* data)
 {
+    ATHOL_TRACE_SCOPE("Input::dispatch");
     auto& input = *reinterpret_cast<Input*>(data);
     libinput_dispatch(input.m_libinput);
     input.processEvents();
@@ -86,36 +201,192 @@ int Input::dispatch(int, uint32_t, void* data)
 
 void Input::processEvents()
 {
+    ATHOL_TRACE_SCOPE("Input::processEvents");
     while (auto* event = libinput_get_event(m_libinput)) {
-        switch (libinput_event_get_type(event)) {
-        case LIBINPUT_EVENT_KEYBOARD_KEY:
-        {
-            auto* keyEvent = libinput_event_get_keyboard_event(event);
-
-            m_client->handleKeyboardEvent(
-                libinput_event_keyboard_get_time(keyEvent),
-                libinput_event_keyboard_get_key(keyEvent),
-                libinput_event_keyboard_get_key_state(keyEvent));
-            break;
+        API::InputEvent inputEvents[2];
+        unsigned count = decodeEvent(event, inputEvents);
+        libinput_event_destroy(event);
+
+        for (unsigned i = 0; i < count; ++i)
+            handleEvent(inputEvents[i]);
+    }
+    m_athol->cursor().flush();
+}
+
+unsigned Input::decodeEvent(struct libinput_event* event, API::InputEvent inputEvents[2])
+{
+    API::InputEvent inputEvent;
+    std::memset(&inputEvent, 0, sizeof(inputEvent));
+
+    switch (libinput_event_get_type(event)) {
+    case LIBINPUT_EVENT_KEYBOARD_KEY:
+    {
+        auto* keyEvent = libinput_event_get_keyboard_event(event);
+        inputEvent.type = API::InputEvent::KeyboardKey;
+        inputEvent.time = libinput_event_keyboard_get_time(keyEvent);
+        inputEvent.timeUsec = libinput_event_keyboard_get_time_usec(keyEvent);
+        inputEvent.key = libinput_event_keyboard_get_key(keyEvent);
+        inputEvent.state = libinput_event_keyboard_get_key_state(keyEvent);
+        inputEvents[0] = inputEvent;
+        return 1;
+    }
+    case LIBINPUT_EVENT_POINTER_MOTION:
+    {
+        auto* pointerEvent = libinput_event_get_pointer_event(event);
+        inputEvent.type = API::InputEvent::PointerMotion;
+        inputEvent.time = libinput_event_pointer_get_time(pointerEvent);
+        inputEvent.timeUsec = libinput_event_pointer_get_time_usec(pointerEvent);
+        inputEvent.dx = libinput_event_pointer_get_dx(pointerEvent);
+        inputEvent.dy = libinput_event_pointer_get_dy(pointerEvent);
+        inputEvents[0] = inputEvent;
+        return 1;
+    }
+    case LIBINPUT_EVENT_POINTER_BUTTON:
+    {
+        auto* pointerEvent = libinput_event_get_pointer_event(event);
+        inputEvent.type = API::InputEvent::PointerButton;
+        inputEvent.time = libinput_event_pointer_get_time(pointerEvent);
+        inputEvent.timeUsec = libinput_event_pointer_get_time_usec(pointerEvent);
+        inputEvent.button = libinput_event_pointer_get_button(pointerEvent);
+        inputEvent.state = libinput_event_pointer_get_button_state(pointerEvent);
+        inputEvents[0] = inputEvent;
+        return 1;
+    }
+    case LIBINPUT_EVENT_POINTER_AXIS:
+    {
+        auto* pointerEvent = libinput_event_get_pointer_event(event);
+        inputEvent.type = API::InputEvent::PointerAxis;
+        inputEvent.time = libinput_event_pointer_get_time(pointerEvent);
+        inputEvent.timeUsec = libinput_event_pointer_get_time_usec(pointerEvent);
+
+        unsigned count = 0;
+        for (auto axis : { LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL }) {
+            if (!libinput_event_pointer_has_axis(pointerEvent, axis))
+                continue;
+            inputEvent.axis = axis;
+            inputEvent.value = libinput_event_pointer_get_axis_value(pointerEvent, axis);
+            inputEvents[count++] = inputEvent;
         }
-        case LIBINPUT_EVENT_POINTER_MOTION:
-        {
-            auto* pointerEvent = libinput_event_get_pointer_event(event);
-            m_client->handlePointerMotion(
-                libinput_event_pointer_get_time(pointerEvent),
-                libinput_event_pointer_get_dx(pointerEvent),
-                libinput_event_pointer_get_dy(pointerEvent));
-            break;
+        return count;
+    }
+    default:
+        return 0;
+    }
+}
+
+void Input::threadLoop()
+{
+    struct pollfd fds[2] = {
+        { libinput_get_fd(m_libinput), POLLIN, 0 },
+        { m_threadStopFd, POLLIN, 0 }
+    };
+
+    while (true) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            std::fprintf(stderr, "[Athol] Input thread failed to poll: %s\n", std::strerror(errno));
+            return;
         }
-        case LIBINPUT_EVENT_POINTER_BUTTON:
-            auto* pointerEvent = libinput_event_get_pointer_event(event);
-            m_client->handlePointerButton(
-                libinput_event_pointer_get_time(pointerEvent),
-                libinput_event_pointer_get_button(pointerEvent),
-                libinput_event_pointer_get_button_state(pointerEvent));
-            break;
+        if (fds[1].revents)
+            return;
+
+        ATHOL_TRACE_SCOPE("Input::threadLoop");
+        libinput_dispatch(m_libinput);
+
+        bool queued = false;
+        while (auto* event = libinput_get_event(m_libinput)) {
+            API::InputEvent inputEvents[2];
+            unsigned count = decodeEvent(event, inputEvents);
+            libinput_event_destroy(event);
+
+            for (unsigned i = 0; i < count; ++i) {
+                // Input is never dropped. When the main loop is so far
+                // behind that the queue fills up, wake it and wait.
+                while (!m_threadQueue.push(inputEvents[i])) {
+                    wakeMainLoop();
+                    usleep(1000);
+                }
+                queued = true;
+            }
         }
 
-        libinput_event_destroy(event);
+        if (queued)
+            wakeMainLoop();
     }
 }
+
+void Input::wakeMainLoop()
+{
+    uint64_t value = 1;
+    if (write(m_threadWakeFd, &value, sizeof(value)) != sizeof(value) && errno != EAGAIN)
+        std::fprintf(stderr, "[Athol] Input thread failed to wake the main loop\n");
+}
+
+int Input::drainThreadQueue(int fd, uint32_t mask, void* data)
+{
+    if (mask != WL_EVENT_READABLE)
+        return 0;
+
+    ATHOL_TRACE_SCOPE("Input::drainThreadQueue");
+    auto& input = *static_cast<Input*>(data);
+
+    uint64_t value;
+    if (read(fd, &value, sizeof(value)) != sizeof(value))
+        return 0;
+
+    API::InputEvent event;
+    while (input.m_threadQueue.pop(event))
+        input.handleEvent(event);
+    input.m_athol->cursor().flush();
+    return 0;
+}
+
+void Input::handleEvent(const API::InputEvent& event)
+{
+    // The cursor moves with the batch, and clients get the events right
+    // away, whether or not they are coalesced for the shell.
+    if (event.type == API::InputEvent::PointerMotion)
+        m_athol->cursor().moveBy(event.dx, event.dy);
+    m_athol->seat().handleEvent(event);
+
+    if (!m_coalesce) {
+        m_client->handleInputEvents(&event, 1);
+        return;
+    }
+
+    if (m_events.empty())
+        m_athol->scheduleInputFlush();
+
+    // Motion and axis events merge into the previous event of the same kind,
+    // so keys and buttons still see the pointer where it was when they
+    // happened.
+    if (!m_events.empty()) {
+        API::InputEvent& last = m_events.back();
+        if (event.type == API::InputEvent::PointerMotion && last.type == API::InputEvent::PointerMotion) {
+            last.time = event.time;
+            last.timeUsec = event.timeUsec;
+            last.dx += event.dx;
+            last.dy += event.dy;
+            return;
+        }
+        if (event.type == API::InputEvent::PointerAxis && last.type == API::InputEvent::PointerAxis && event.axis == last.axis) {
+            last.time = event.time;
+            last.timeUsec = event.timeUsec;
+            last.value += event.value;
+            return;
+        }
+    }
+
+    m_events.push_back(event);
+}
+
+void Input::flushEvents()
+{
+    if (m_events.empty())
+        return;
+
+    ATHOL_TRACE_SCOPE("Input::flushEvents");
+    m_client->handleInputEvents(m_events.data(), m_events.size());
+    m_events.clear();
+}
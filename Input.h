@@ -28,23 +28,66 @@
 #ifndef Input_h
 #define Input_h
 
+#include "RingBuffer.h"
 #include <API/Interfaces.h>
 #include <libinput.h>
 #include <libudev.h>
+#include <thread>
+#include <vector>
 #include <wayland-server.h>
 
 class Athol;
 
 class Input {
 public:
-    Input() = default;
-    void initialize(const Athol&, std::unique_ptr<API::InputClient>);
+    Input();
+    ~Input();
+
+    // The devices are opened on a startup thread, events are delivered once
+    // that is done.
+    void initialize(Athol&, std::unique_ptr<API::InputClient>);
+    bool isInitialized() const { return m_initialized; }
+
+    // Delivers the events coalesced since the last frame.
+    void flushEvents();
 
 private:
     static struct libinput_interface m_interface;
 
+    // The seat is enumerated on the startup thread, which signals the
+    // startup fd once libinput is set up, or has failed to.
+    void initializeSeat();
+    static int finishInitialize(int, uint32_t, void*);
+    std::thread m_startupThread;
+    int m_startupFd;
+    struct wl_event_source* m_startupSource;
+    bool m_initialized;
+
     static int dispatch(int, uint32_t, void*);
     void processEvents();
+    void handleEvent(const API::InputEvent&);
+
+    // Returns how many events were decoded, axis events can carry two.
+    static unsigned decodeEvent(struct libinput_event*, API::InputEvent[2]);
+
+    // With ATHOL_INPUT_THREAD=1, libinput is dispatched on its own thread,
+    // which queues the decoded events for the main loop and wakes it.
+    bool startThread(struct wl_event_loop*);
+    void threadLoop();
+    void wakeMainLoop();
+    static int drainThreadQueue(int, uint32_t, void*);
+
+    std::thread m_thread;
+    int m_threadWakeFd;
+    int m_threadStopFd;
+    RingBuffer<API::InputEvent, 1024> m_threadQueue;
+
+    Athol* m_athol;
+
+    // Events waiting for the next frame, only used when coalescing. The
+    // capacity is kept across frames.
+    bool m_coalesce;
+    std::vector<API::InputEvent> m_events;
 
     struct udev* m_udev;
     struct libinput* m_libinput;
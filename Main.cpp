@@ -27,12 +27,17 @@
 
 #include "Athol.h"
 #include "ShellLoader.h"
+#include "Startup.h"
+#include <cstdlib>
 
 int main()
 {
     Athol athol("athol-0");
 
-    ShellLoader::load(&athol);
+    {
+        Startup::Phase phase("shell");
+        ShellLoader::load(&athol);
+    }
 
     athol.run();
     return EXIT_SUCCESS;
@@ -0,0 +1,521 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Output.h"
+
+#include "Athol.h"
+#include "Presentation.h"
+#include "Region.h"
+#include "Startup.h"
+#include "Surface.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <presentation-time-server-protocol.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <vector>
+
+Output::Output(Athol& athol, unsigned index)
+    : m_athol(athol)
+    , m_index(index)
+    , m_x(0)
+    , m_global(nullptr)
+    , m_nextLayer(1)
+    , m_stackChanged(false)
+    , m_throttleTimer(nullptr)
+    , m_throttleInterval(1000)
+    , m_updateSerial(0)
+    , m_completedUpdates(0)
+    , m_vsyncSource(nullptr)
+    , m_eventfd(-1)
+    , m_background(Backend::NoHandle)
+{
+    std::memset(&m_report, 0, sizeof(m_report));
+    m_lastCompletion.time = 0;
+    m_lastCompletion.sequence = 0;
+
+    wl_list_init(&m_resources);
+    wl_list_init(&m_surfaceList);
+    wl_list_init(&m_surfaceUpdateList);
+    wl_list_init(&m_surfaceFrameList);
+    wl_list_init(&m_throttledSurfaceList);
+}
+
+Output::~Output()
+{
+    // The event sources and the global went away with the display.
+    m_update = nullptr;
+
+    if (m_background != Backend::NoHandle)
+        m_backend->deleteResource(m_background);
+    m_backend = nullptr;
+
+    if (m_eventfd != -1)
+        close(m_eventfd);
+}
+
+void* Output::operator new(size_t size)
+{
+    void* pointer;
+    if (posix_memalign(&pointer, alignof(Output), size))
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void Output::operator delete(void* pointer)
+{
+    std::free(pointer);
+}
+
+bool Output::initializeBackend(const char* name)
+{
+    m_name = name ? name : "default";
+    Startup::Phase phase("display " + m_name);
+
+    m_backend = Backend::create(name);
+    return m_backend && m_backend->initialize(updateComplete, this);
+}
+
+bool Output::initialize(int32_t x)
+{
+    struct wl_display* display = m_athol.display();
+    struct wl_event_loop* loop = wl_display_get_event_loop(display);
+
+    m_x = x;
+
+    m_eventfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_eventfd == -1)
+        return false;
+
+    // Completions and repaints go ahead of clients.
+    m_vsyncSource = wl_event_loop_add_fd(m_athol.priorityLoop(), m_eventfd, WL_EVENT_READABLE, vsyncCallback, this);
+
+    if (!m_frameClock.initialize(m_athol.priorityLoop(), repaintCallback, this))
+        return false;
+
+    if (const char* rate = getenv("ATHOL_HIDDEN_FRAME_RATE")) {
+        double hertz = std::atof(rate);
+        m_throttleInterval = hertz > 0 ? std::max(1, int(1000 / hertz)) : 0;
+    }
+    if (m_throttleInterval) {
+        m_throttleTimer = wl_event_loop_add_timer(loop, throttleTimerCallback, this);
+        if (!m_throttleTimer)
+            return false;
+    }
+
+    m_backend->bindDisplay(display);
+    m_backend->setVblankCallback(FrameClock::vblank, &m_frameClock);
+
+    uint32_t black = 0xff000000;
+    m_background = m_backend->createResource(1, 1, &black, sizeof(black));
+
+    m_global = wl_global_create(display, &wl_output_interface, 2, this, bindOutputInterface);
+    return !!m_global;
+}
+
+void Output::scheduleRepaint(Surface& surface)
+{
+    uint64_t now = FrameClock::now();
+    if (!m_report.pendingCommits)
+        m_report.pendingEarliestCommit = now;
+    m_report.pendingCommits++;
+    m_report.pendingCommitTimeSum += now;
+
+    surface.statistics.commits++;
+    if (!surface.statistics.pendingCommit)
+        surface.statistics.pendingCommit = now;
+
+    if (wl_list_empty(&surface.link))
+        wl_list_insert(m_surfaceUpdateList.prev, &surface.link);
+
+    scheduleRepaint();
+}
+
+void Output::scheduleRepaint()
+{
+    m_frameClock.scheduleRepaint();
+}
+
+Output::Update& Output::frameUpdate()
+{
+    if (!m_update) {
+        m_update.reset(new Update(*this));
+        scheduleRepaint();
+    }
+    return *m_update;
+}
+
+std::unique_ptr<Output::Update> Output::takeUpdate()
+{
+    if (m_update)
+        return std::move(m_update);
+    return std::unique_ptr<Update>(new Update(*this));
+}
+
+int32_t Output::addSurface(Surface& surface)
+{
+    wl_list_insert(m_surfaceList.prev, &surface.stackLink);
+    m_report.surfaces++;
+    return m_nextLayer++;
+}
+
+void Output::removeSurface(Surface& surface)
+{
+    wl_list_remove(&surface.stackLink);
+    wl_list_remove(&surface.link);
+    wl_list_init(&surface.link);
+    wl_list_remove(&surface.frameLink);
+    wl_list_init(&surface.frameLink);
+    wl_list_remove(&surface.throttleLink);
+    wl_list_init(&surface.throttleLink);
+    m_report.surfaces--;
+    m_stackChanged = true;
+
+    // Whatever the surface was hiding may have to be shown again.
+    scheduleRepaint();
+}
+
+void Output::scheduleRestack()
+{
+    m_stackChanged = true;
+    scheduleRepaint();
+}
+
+void Output::throttleFrameCallbacks(Surface& surface)
+{
+    if (!wl_list_empty(&surface.throttleLink))
+        return;
+
+    if (wl_list_empty(&m_throttledSurfaceList) && m_throttleTimer)
+        wl_event_source_timer_update(m_throttleTimer, m_throttleInterval);
+    wl_list_insert(m_throttledSurfaceList.prev, &surface.throttleLink);
+}
+
+void Output::unthrottleFrameCallbacks(Surface& surface)
+{
+    if (wl_list_empty(&surface.throttleLink))
+        return;
+
+    wl_list_remove(&surface.throttleLink);
+    wl_list_init(&surface.throttleLink);
+    surface.dispatchThrottledFrameCallbacks(FrameClock::now());
+}
+
+int Output::throttleTimerCallback(void* data)
+{
+    auto& output = *static_cast<Output*>(data);
+    uint64_t now = FrameClock::now();
+
+    // Surfaces throttled again after this are picked up a full interval
+    // later.
+    Surface* surface;
+    Surface* nextSurface;
+    wl_list_for_each_safe(surface, nextSurface, &output.m_throttledSurfaceList, throttleLink) {
+        wl_list_remove(&surface->throttleLink);
+        wl_list_init(&surface->throttleLink);
+        surface->dispatchThrottledFrameCallbacks(now);
+    }
+    return 0;
+}
+
+void Output::enterSurface(struct wl_resource* surface)
+{
+    struct wl_client* client = wl_resource_get_client(surface);
+    struct wl_resource* resource;
+    wl_resource_for_each(resource, &m_resources) {
+        if (wl_resource_get_client(resource) == client)
+            wl_surface_send_enter(surface, resource);
+    }
+}
+
+void Output::leaveSurface(struct wl_resource* surface)
+{
+    struct wl_client* client = wl_resource_get_client(surface);
+    struct wl_resource* resource;
+    wl_resource_for_each(resource, &m_resources) {
+        if (wl_resource_get_client(resource) == client)
+            wl_surface_send_leave(surface, resource);
+    }
+}
+
+void Output::repaintCallback(void* data)
+{
+    static_cast<Output*>(data)->repaint();
+}
+
+void Output::repaint()
+{
+    ATHOL_TRACE_SCOPE("Output::repaint");
+    uint64_t repaintTime = FrameClock::now();
+
+    // Coalesced input is delivered in step with the first output.
+    if (!m_index)
+        m_athol.flushInput();
+
+    // Repaints scheduled only to flush input have nothing to submit.
+    if (wl_list_empty(&m_surfaceUpdateList) && !m_update && !m_stackChanged)
+        return;
+
+    auto& report = m_report;
+    if (!report.submittedCommits)
+        report.submittedEarliestCommit = report.pendingEarliestCommit;
+    report.submittedCommits += report.pendingCommits;
+    report.submittedCommitTimeSum += report.pendingCommitTimeSum;
+    report.pendingCommits = 0;
+    report.pendingCommitTimeSum = 0;
+
+    if (!m_update)
+        m_update.reset(new Update(*this));
+    Output::Update& update = *m_update;
+
+    if (m_stackChanged) {
+        restack(update);
+        m_stackChanged = false;
+    }
+
+    FrameStatistics& statistics = m_athol.statistics();
+    bool committed = !wl_list_empty(&m_surfaceUpdateList);
+    Surface* surface;
+    Surface* nextSurface;
+    wl_list_for_each_safe(surface, nextSurface, &m_surfaceUpdateList, link) {
+        if (surface->statistics.pendingCommit) {
+            statistics.repainted(surface->statistics.pendingCommit, repaintTime);
+            surface->statistics.pendingCommit = 0;
+        }
+        surface->repaint(update);
+
+        wl_list_remove(&surface->link);
+        wl_list_init(&surface->link);
+        if (wl_list_empty(&surface->frameLink))
+            wl_list_insert(m_surfaceFrameList.prev, &surface->frameLink);
+    }
+
+    // Top-level surfaces that changed size rescale their subsurfaces in the
+    // same frame.
+    if (m_stackChanged) {
+        restack(update);
+        m_stackChanged = false;
+    }
+
+    updateOcclusion(update);
+
+    // Submits the update.
+    uint64_t serial = update.serial();
+    uint64_t vblank = m_frameClock.vblankCount();
+    m_update = nullptr;
+    statistics.submitted(m_index, serial, repaintTime, FrameClock::now(), vblank);
+
+    if (committed)
+        Startup::firstClientFrame();
+}
+
+void Output::restack(Update& update)
+{
+    // Top-level surfaces keep their order, and bring their subsurfaces along.
+    std::vector<Surface*> surfaces;
+    Surface* surface;
+    wl_list_for_each(surface, &m_surfaceList, stackLink) {
+        if (!surface->parent())
+            surfaces.push_back(surface);
+    }
+
+    wl_list_init(&m_surfaceList);
+    int32_t layer = 1;
+    for (Surface* surface : surfaces)
+        surface->restack(update, &m_surfaceList, layer, 0, 0);
+    m_nextLayer = layer;
+}
+
+void Output::updateOcclusion(Update& update)
+{
+    // Walk the stack from the top, hiding the elements of surfaces that are
+    // completely covered by opaque surfaces above them, so that the HVS does
+    // not fetch them.
+    Region covered;
+    Surface* surface;
+    wl_list_for_each_reverse(surface, &m_surfaceList, stackLink) {
+        // Surfaces that show nothing yet are never occluded, which would
+        // hold back the frame callbacks they may be waiting for to draw.
+        Backend::Rect extent = surface->extent();
+        bool empty = extent.width <= 0 || extent.height <= 0;
+        surface->setOccluded(update, !empty && covered.contains(extent));
+        covered.unite(surface->opaqueRegion());
+    }
+}
+
+int Output::vsyncCallback(int fd, uint32_t mask, void* data)
+{
+    if (mask != WL_EVENT_READABLE)
+        return 1;
+
+    ATHOL_TRACE_SCOPE("Output::vsyncCallback");
+    Output& output = *static_cast<Output*>(data);
+
+    uint64_t completed;
+    ssize_t ret = read(fd, &completed, sizeof(completed));
+    if (ret != sizeof(completed))
+        return 1;
+
+    for (uint64_t i = 0; i < completed; ++i) {
+        // Past a full queue, completions share the last vblank known.
+        output.m_completions.pop(output.m_lastCompletion);
+        output.completeUpdate(output.m_lastCompletion);
+    }
+    return 1;
+}
+
+void Output::completeUpdate(const Completion& completion)
+{
+    Presentation::Timing timing;
+    timing.time = completion.time;
+    timing.refresh = m_frameClock.refreshInterval();
+    timing.sequence = completion.sequence;
+    timing.flags = WP_PRESENTATION_FEEDBACK_KIND_VSYNC | WP_PRESENTATION_FEEDBACK_KIND_HW_COMPLETION;
+    timing.outputs = &m_resources;
+
+    m_completedUpdates++;
+    m_athol.statistics().completed(m_index, m_completedUpdates, timing.time, timing.sequence);
+
+    auto& report = m_report;
+    if (report.submittedCommits) {
+        report.frames++;
+        report.presentedCommits += report.submittedCommits;
+        report.latencySum += report.submittedCommits * timing.time - report.submittedCommitTimeSum;
+        if (timing.time - report.submittedEarliestCommit > report.latencyMax)
+            report.latencyMax = timing.time - report.submittedEarliestCommit;
+        report.submittedCommits = 0;
+        report.submittedCommitTimeSum = 0;
+    }
+
+    Surface* surface;
+    Surface* nextSurface;
+    wl_list_for_each_safe(surface, nextSurface, &m_surfaceFrameList, frameLink) {
+        if (surface->dispatchFrameCallbacks(m_completedUpdates, timing))
+            continue;
+
+        wl_list_remove(&surface->frameLink);
+        wl_list_init(&surface->frameLink);
+    }
+}
+
+void Output::updateComplete(void* data)
+{
+    ATHOL_TRACE_SCOPE("Output::updateComplete");
+    Output& output = *static_cast<Output*>(data);
+
+    // The update was picked up at the latest vblank, whose callback may
+    // not have run yet, or just now without vblanks.
+    Completion completion;
+    output.m_frameClock.lastVblank(completion.time, completion.sequence);
+    uint64_t now = FrameClock::now();
+    uint64_t refreshInterval = output.m_frameClock.refreshInterval();
+    if (!completion.time)
+        completion.time = now;
+    else if (now - completion.time >= refreshInterval) {
+        uint64_t missed = (now - completion.time) / refreshInterval;
+        completion.time += missed * refreshInterval;
+        completion.sequence += missed;
+    }
+    if (!output.m_completions.push(completion))
+        std::fprintf(stderr, "[Athol] Too many pending completions on %s\n", output.m_name.c_str());
+
+    uint64_t completed = 1;
+    ssize_t ret = write(output.m_eventfd, &completed, sizeof(completed));
+    if (ret != sizeof(completed))
+        return; // FIXME: At least log this.
+}
+
+void Output::reportFrames(int interval)
+{
+    auto& report = m_report;
+
+    double averageLatency = report.presentedCommits ? double(report.latencySum) / report.presentedCommits : 0;
+    uint64_t uploadedBytes = m_backend->uploadedBytes();
+    double uploadedPerFrame = report.frames ? double(uploadedBytes - report.uploadedBytes) / report.frames : 0;
+    std::fprintf(stderr, "[Athol] %s: %u surfaces, %.1f fps, commit-to-present latency avg %.2f ms max %.2f ms, %.1f KiB uploaded per frame\n",
+        m_name.c_str(), report.surfaces, double(report.frames) / interval, averageLatency / 1000000, report.latencyMax / 1000000.0,
+        uploadedPerFrame / 1024);
+    report.uploadedBytes = uploadedBytes;
+
+    report.frames = 0;
+    report.presentedCommits = 0;
+    report.latencySum = 0;
+    report.latencyMax = 0;
+}
+
+void Output::bindOutputInterface(struct wl_client* client, void* data, uint32_t version, uint32_t id)
+{
+    auto& output = *static_cast<Output*>(data);
+    struct wl_resource* resource = wl_resource_create(client, &wl_output_interface, std::min<uint32_t>(version, 2), id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    // wl_output has no requests before version 3.
+    wl_resource_set_implementation(resource, nullptr, &output,
+        [](struct wl_resource* resource)
+        {
+            wl_list_remove(wl_resource_get_link(resource));
+        });
+    wl_list_insert(&output.m_resources, wl_resource_get_link(resource));
+
+    // The display does not report its physical size, and the refresh rate
+    // is only known once vblanks have been counted.
+    uint64_t refresh = output.m_frameClock.refreshInterval();
+    wl_output_send_geometry(resource, output.m_x, 0, 0, 0, WL_OUTPUT_SUBPIXEL_UNKNOWN,
+        "Athol", output.m_name.c_str(), WL_OUTPUT_TRANSFORM_NORMAL);
+    wl_output_send_mode(resource, WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
+        output.width(), output.height(), refresh ? int32_t(1000000000000ull / refresh) : 60000);
+    if (wl_resource_get_version(resource) >= WL_OUTPUT_SCALE_SINCE_VERSION)
+        wl_output_send_scale(resource, 1);
+    if (wl_resource_get_version(resource) >= WL_OUTPUT_DONE_SINCE_VERSION)
+        wl_output_send_done(resource);
+
+    // Surfaces the client created before binding the output.
+    Surface* surface;
+    wl_list_for_each(surface, &output.m_surfaceList, stackLink) {
+        if (surface->resource() && wl_resource_get_client(surface->resource()) == client)
+            wl_surface_send_enter(surface->resource(), resource);
+    }
+}
+
+Output::Update::Update(Output& output)
+    : m_output(output)
+    , m_serial(++output.m_updateSerial)
+{
+    m_updateHandle = output.m_backend->startUpdate();
+}
+
+Output::Update::~Update()
+{
+    m_output.m_backend->submitUpdate(m_updateHandle);
+}
@@ -0,0 +1,214 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Output_h
+#define Output_h
+
+#include "Backend.h"
+#include "FrameClock.h"
+#include "RingBuffer.h"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <wayland-server.h>
+
+class Athol;
+class Surface;
+
+// One display, with its own backend, frame clock and surface stack, so that
+// each display repaints at its own pace. A slow frame on one output never
+// holds back the updates or the frame callbacks of another.
+class Output {
+public:
+    Output(Athol&, unsigned index);
+    ~Output();
+
+    Output(const Output&) = delete;
+    Output& operator=(const Output&) = delete;
+
+    // The completion queue is aligned to cache lines, which plain new does
+    // not honour before C++17.
+    static void* operator new(size_t);
+    static void operator delete(void*);
+
+    // Brings up the display, on the startup thread. The name is the
+    // backend's, "hdmi" or "lcd" on the Raspberry Pi.
+    bool initializeBackend(const char* name);
+
+    // Then, on the main thread, hooks the output up to the event loop and
+    // advertises it. x is where the output sits in the global space.
+    bool initialize(int32_t x);
+
+    unsigned index() const { return m_index; }
+    const std::string& name() const { return m_name; }
+    int32_t x() const { return m_x; }
+
+    void scheduleRepaint(Surface&);
+    void scheduleRepaint();
+
+    // Submits what changed since the last repaint. Called by the frame
+    // clock, or directly while it is inhibited.
+    void repaint();
+    FrameClock& frameClock() { return m_frameClock; }
+
+    // Surfaces are stacked in creation order, each followed by its
+    // subsurfaces. Returns the dispmanx layer of the new surface.
+    int32_t addSurface(Surface&);
+    void removeSurface(Surface&);
+
+    // Reassigns layers and positions at the next repaint.
+    void scheduleRestack();
+
+    // Sends wl_surface.enter and leave for the wl_output resources bound by
+    // the surface's client.
+    void enterSurface(struct wl_resource*);
+    void leaveSurface(struct wl_resource*);
+
+    // Frame callbacks held back by throttled surfaces are sent together at
+    // ATHOL_HIDDEN_FRAME_RATE=<Hz>, 1 by default, or only once the surfaces
+    // stop being throttled with 0.
+    void throttleFrameCallbacks(Surface&);
+    void unthrottleFrameCallbacks(Surface&);
+
+    // A dispmanx transaction. Everything changed during one iteration of the
+    // event loop goes into the same update, submitted at repaint time.
+    class Update {
+    public:
+        Update(Output&);
+        ~Update();
+
+        Update(const Update&) = delete;
+        Update& operator=(const Update&) = delete;
+
+        uint32_t width() { return m_output.width(); }
+        uint32_t height() { return m_output.height(); }
+
+        Backend& backend() { return *m_output.m_backend; }
+        Backend::UpdateHandle handle() { return m_updateHandle; }
+
+        // Updates complete in the order of their serials, which are counted
+        // per output.
+        uint64_t serial() const { return m_serial; }
+
+    private:
+        Output& m_output;
+        Backend::UpdateHandle m_updateHandle;
+        uint64_t m_serial;
+    };
+
+    // The update for the next frame, which is scheduled as needed.
+    Update& frameUpdate();
+
+    // An update submitted as soon as the caller drops it, for teardown once
+    // nothing repaints any more. It is the frame update if there is one, so
+    // that updates are still submitted in the order of their serials.
+    std::unique_ptr<Update> takeUpdate();
+    uint64_t completedUpdates() const { return m_completedUpdates; }
+
+    uint32_t width() { return m_backend->width(); }
+    uint32_t height() { return m_backend->height(); }
+    Backend& backend() { return *m_backend; }
+
+    // A single black pixel, scaled up to fill the screen behind surfaces
+    // that have no content yet.
+    Backend::ResourceHandle backgroundResource() const { return m_background; }
+
+    const struct wl_list* surfaceList() const { return &m_surfaceList; }
+
+    // Prints and resets the counters of ATHOL_FRAME_REPORT.
+    void reportFrames(int interval);
+
+private:
+    static void bindOutputInterface(struct wl_client*, void*, uint32_t, uint32_t);
+
+    Athol& m_athol;
+    unsigned m_index;
+    std::string m_name;
+    int32_t m_x;
+
+    struct wl_global* m_global;
+    struct wl_list m_resources;
+
+    struct wl_list m_surfaceList;
+    int32_t m_nextLayer;
+    bool m_stackChanged;
+    void restack(Update&);
+    void updateOcclusion(Update&);
+
+    // Surfaces committed since the last repaint, and surfaces waiting for
+    // their update to complete.
+    struct wl_list m_surfaceUpdateList;
+    struct wl_list m_surfaceFrameList;
+    struct wl_list m_throttledSurfaceList;
+    struct wl_event_source* m_throttleTimer;
+    int m_throttleInterval;
+    static int throttleTimerCallback(void*);
+    uint64_t m_updateSerial;
+    uint64_t m_completedUpdates;
+
+    // One entry per completed update, pushed by updateComplete on the one
+    // thread the backend calls it from, and popped as the eventfd counts
+    // them, so that completions read together keep their own vblank.
+    struct Completion {
+        uint64_t time;
+        uint64_t sequence;
+    };
+    RingBuffer<Completion, 64> m_completions;
+    Completion m_lastCompletion;
+
+    struct wl_event_source* m_vsyncSource;
+    FrameClock m_frameClock;
+    int m_eventfd;
+    static void repaintCallback(void*);
+    static int vsyncCallback(int, uint32_t, void*);
+    static void updateComplete(void*);
+    void completeUpdate(const Completion&);
+
+    std::unique_ptr<Backend> m_backend;
+    Backend::ResourceHandle m_background;
+    std::unique_ptr<Update> m_update;
+
+    struct FrameReport {
+        unsigned surfaces;
+
+        unsigned pendingCommits;
+        uint64_t pendingCommitTimeSum;
+        uint64_t pendingEarliestCommit;
+
+        unsigned submittedCommits;
+        uint64_t submittedCommitTimeSum;
+        uint64_t submittedEarliestCommit;
+
+        unsigned frames;
+        unsigned presentedCommits;
+        uint64_t latencySum;
+        uint64_t latencyMax;
+        uint64_t uploadedBytes;
+    } m_report;
+};
+
+#endif // Output_h
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Presentation.h"
+
+#include "Surface.h"
+#include <presentation-time-server-protocol.h>
+#include <time.h>
+
+bool Presentation::initialize(struct wl_display* display)
+{
+    return !!wl_global_create(display, &wp_presentation_interface, 1, nullptr, bindPresentationInterface);
+}
+
+void Presentation::present(struct wl_list* feedbacks, uint64_t completedUpdate, const Timing& timing)
+{
+    uint64_t seconds = timing.time / 1000000000;
+    uint32_t nanoseconds = timing.time % 1000000000;
+
+    Feedback* feedback;
+    Feedback* nextFeedback;
+    wl_list_for_each_safe(feedback, nextFeedback, feedbacks, link) {
+        if (feedback->update > completedUpdate)
+            continue;
+
+        if (timing.outputs) {
+            struct wl_client* client = wl_resource_get_client(feedback->resource);
+            struct wl_resource* output;
+            wl_resource_for_each(output, timing.outputs) {
+                if (wl_resource_get_client(output) == client)
+                    wp_presentation_feedback_send_sync_output(feedback->resource, output);
+            }
+        }
+
+        wp_presentation_feedback_send_presented(feedback->resource,
+            seconds >> 32, seconds & 0xffffffff, nanoseconds, timing.refresh,
+            timing.sequence >> 32, timing.sequence & 0xffffffff, timing.flags);
+        wl_resource_destroy(feedback->resource);
+    }
+}
+
+void Presentation::discard(struct wl_list* feedbacks)
+{
+    Feedback* feedback;
+    Feedback* nextFeedback;
+    wl_list_for_each_safe(feedback, nextFeedback, feedbacks, link) {
+        wp_presentation_feedback_send_discarded(feedback->resource);
+        wl_resource_destroy(feedback->resource);
+    }
+}
+
+void Presentation::bindPresentationInterface(struct wl_client* client, void*, uint32_t, uint32_t id)
+{
+    struct wl_resource* resource = wl_resource_create(client, &wp_presentation_interface, 1, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &m_presentationInterface, nullptr, nullptr);
+    wp_presentation_send_clock_id(resource, CLOCK_MONOTONIC);
+}
+
+const struct wp_presentation_interface Presentation::m_presentationInterface = {
+    // destroy
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    },
+    // feedback
+    [](struct wl_client* client, struct wl_resource*, struct wl_resource* surfaceResource, uint32_t id)
+    {
+        auto* feedback = new Feedback;
+        feedback->resource = wl_resource_create(client, &wp_presentation_feedback_interface, 1, id);
+        if (!feedback->resource) {
+            delete feedback;
+            wl_client_post_no_memory(client);
+            return;
+        }
+
+        feedback->update = 0;
+        wl_resource_set_implementation(feedback->resource, nullptr, feedback,
+            [](struct wl_resource* resource) {
+                auto* feedback = static_cast<Feedback*>(wl_resource_get_user_data(resource));
+                wl_list_remove(&feedback->link);
+                delete feedback;
+            });
+
+        auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(surfaceResource));
+        surface.addPresentationFeedback(*feedback);
+    }
+};
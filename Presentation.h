@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Presentation_h
+#define Presentation_h
+
+#include <cstdint>
+#include <wayland-server.h>
+
+// The wp_presentation global, reporting when each commit made it to the
+// screen, on CLOCK_MONOTONIC.
+class Presentation {
+public:
+    struct Timing {
+        uint64_t time;
+        uint64_t refresh;
+        uint64_t sequence;
+        uint32_t flags;
+        // The wl_output resources of the output that showed the update, or
+        // null when there was none.
+        const struct wl_list* outputs;
+    };
+
+    struct Feedback {
+        struct wl_resource* resource;
+        struct wl_list link;
+        uint64_t update;
+    };
+
+    static bool initialize(struct wl_display*);
+
+    // Sends presented for, and destroys, the feedbacks of completed updates.
+    static void present(struct wl_list* feedbacks, uint64_t completedUpdate, const Timing&);
+    static void discard(struct wl_list* feedbacks);
+
+private:
+    static void bindPresentationInterface(struct wl_client*, void*, uint32_t, uint32_t);
+    static const struct wp_presentation_interface m_presentationInterface;
+};
+
+#endif // Presentation_h
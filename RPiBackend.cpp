@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RPiBackend.h"
+
+#include "Trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+RPiBackend::RPiBackend(const char* output)
+    : m_bindDisplay(nullptr)
+    , m_queryWaylandBuffer(nullptr)
+    , m_completionCallback(nullptr)
+    , m_completionData(nullptr)
+    , m_vblankCallback(nullptr)
+    , m_vblankData(nullptr)
+    , m_eglDisplay(EGL_NO_DISPLAY)
+    , m_output(output ? output : "hdmi")
+    , m_displayHandle(DISPMANX_NO_HANDLE)
+    , m_width(0)
+    , m_height(0)
+    , m_uploadedBytes(0)
+    , m_startedUpdates(0)
+    , m_completedUpdates(0)
+{
+}
+
+RPiBackend::~RPiBackend()
+{
+    if (m_vblankCallback)
+        vc_dispmanx_vsync_callback(m_displayHandle, nullptr, nullptr);
+
+    for (auto& element : m_shmElements) {
+        for (auto& resource : element.second.resources)
+            m_resourcePool.release(resource);
+    }
+    for (auto& retired : m_retiredResources)
+        m_resourcePool.release(retired.resource);
+
+    if (m_displayHandle != DISPMANX_NO_HANDLE)
+        vc_dispmanx_display_close(m_displayHandle);
+}
+
+bool RPiBackend::initialize(CompletionCallback callback, void* data)
+{
+    m_completionCallback = callback;
+    m_completionData = data;
+
+    m_eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    eglInitialize(m_eglDisplay, nullptr, nullptr);
+
+    m_bindDisplay = reinterpret_cast<BindDisplayType>(eglGetProcAddress("eglBindWaylandDisplayWL"));
+    m_queryWaylandBuffer = reinterpret_cast<QueryWaylandBufferType>(eglGetProcAddress("eglQueryWaylandBufferWL"));
+    if (!m_bindDisplay || !m_queryWaylandBuffer) {
+        std::fprintf(stderr, "[Athol] EGL_WL_bind_wayland_display not supported.\n");
+        return false;
+    }
+
+    uint32_t displayId;
+    if (m_output == "hdmi")
+        displayId = DISPMANX_ID_HDMI;
+    else if (m_output == "lcd")
+        displayId = DISPMANX_ID_MAIN_LCD;
+    else {
+        std::fprintf(stderr, "[Athol] Unknown dispmanx display %s\n", m_output.c_str());
+        return false;
+    }
+
+    bcm_host_init();
+
+    m_displayHandle = vc_dispmanx_display_open(displayId);
+    if (m_displayHandle == DISPMANX_NO_HANDLE) {
+        std::fprintf(stderr, "[Athol] Cannot open dispmanx display %s\n", m_output.c_str());
+        return false;
+    }
+
+    graphics_get_display_size(displayId, &m_width, &m_height);
+    return true;
+}
+
+void RPiBackend::bindDisplay(struct wl_display* display)
+{
+    // Every output binds the same EGL display, which only the first one
+    // does successfully.
+    m_bindDisplay(m_eglDisplay, display);
+}
+
+void RPiBackend::setVblankCallback(VblankCallback callback, void* data)
+{
+    m_vblankCallback = callback;
+    m_vblankData = data;
+    vc_dispmanx_vsync_callback(m_displayHandle, callback ? RPiBackend::vsync : nullptr, this);
+}
+
+Backend::UpdateHandle RPiBackend::startUpdate()
+{
+    releaseRetiredResources();
+    UpdateHandle update = vc_dispmanx_update_start(10);
+    m_openUpdates.push_back({ update, ++m_startedUpdates });
+    return update;
+}
+
+void RPiBackend::submitUpdate(UpdateHandle update)
+{
+    ATHOL_TRACE_SCOPE("vc_dispmanx_update_submit");
+
+    m_openUpdates.erase(std::remove_if(m_openUpdates.begin(), m_openUpdates.end(),
+        [update](const OpenUpdate& openUpdate) { return openUpdate.handle == update; }), m_openUpdates.end());
+    vc_dispmanx_update_submit(update, RPiBackend::updateComplete, this);
+}
+
+Backend::ResourceHandle RPiBackend::createResource(uint32_t width, uint32_t height, const void* pixels, uint32_t stride)
+{
+    uint32_t imagePtr;
+    VC_RECT_T rect;
+    vc_dispmanx_rect_set(&rect, 0, 0, width, height);
+
+    DISPMANX_RESOURCE_HANDLE_T resource = vc_dispmanx_resource_create(VC_IMAGE_ARGB8888, width, height, &imagePtr);
+    vc_dispmanx_resource_write_data(resource, VC_IMAGE_ARGB8888, stride, const_cast<void*>(pixels), &rect);
+    return resource;
+}
+
+void RPiBackend::deleteResource(ResourceHandle resource)
+{
+    vc_dispmanx_resource_delete(resource);
+}
+
+// The display is mounted rotated, so elements are rotated by 90 degrees and
+// screen coordinates are transposed into display coordinates. The HVS scales
+// the source, in 16.16 fixed point, to the destination.
+static void setSourceRect(VC_RECT_T& srcRect, uint32_t sourceWidth, uint32_t sourceHeight)
+{
+    vc_dispmanx_rect_set(&srcRect, 0, 0, sourceHeight << 16, sourceWidth << 16);
+}
+
+static void setDestinationRect(VC_RECT_T& destRect, const Backend::Rect& destination)
+{
+    vc_dispmanx_rect_set(&destRect, destination.y, destination.x, destination.height, destination.width);
+}
+
+Backend::ElementHandle RPiBackend::addElement(UpdateHandle update, int32_t layer, ResourceHandle resource, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination, bool opaque)
+{
+    static VC_DISPMANX_ALPHA_T opaqueAlpha = {
+        static_cast<DISPMANX_FLAGS_ALPHA_T>(DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS),
+        255, 0
+    };
+    static VC_DISPMANX_ALPHA_T blendedAlpha = {
+        static_cast<DISPMANX_FLAGS_ALPHA_T>(DISPMANX_FLAGS_ALPHA_FROM_SOURCE | DISPMANX_FLAGS_ALPHA_PREMULT),
+        255, 0
+    };
+
+    VC_RECT_T srcRect, destRect;
+    setSourceRect(srcRect, sourceWidth, sourceHeight);
+    setDestinationRect(destRect, destination);
+
+    return vc_dispmanx_element_add(update, m_displayHandle, layer,
+        &destRect, resource, &srcRect, DISPMANX_PROTECTION_NONE, opaque ? &opaqueAlpha : &blendedAlpha,
+        nullptr, DISPMANX_ROTATE_90);
+}
+
+void RPiBackend::removeElement(UpdateHandle update, ElementHandle element)
+{
+    vc_dispmanx_element_remove(update, element);
+    releaseShmElement(update, element);
+}
+
+void RPiBackend::changeElementAttributes(UpdateHandle update, ElementHandle element, int32_t layer, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination)
+{
+    static const uint32_t changeLayer = 1 << 0;
+    static const uint32_t changeDestRect = 1 << 2;
+    static const uint32_t changeSrcRect = 1 << 3;
+
+    VC_RECT_T srcRect, destRect;
+    setSourceRect(srcRect, sourceWidth, sourceHeight);
+    setDestinationRect(destRect, destination);
+    vc_dispmanx_element_change_attributes(update, element, changeLayer | changeDestRect | changeSrcRect,
+        layer, 0, &destRect, &srcRect, DISPMANX_NO_HANDLE, DISPMANX_ROTATE_90);
+}
+
+bool RPiBackend::queryBufferInfo(struct wl_resource* buffer, BufferInfo& info)
+{
+    if (struct wl_shm_buffer* shmBuffer = wl_shm_buffer_get(buffer)) {
+        info.width = wl_shm_buffer_get_width(shmBuffer);
+        info.height = wl_shm_buffer_get_height(shmBuffer);
+        info.shm = true;
+        info.shmFormat = wl_shm_buffer_get_format(shmBuffer);
+        info.handle = NoHandle;
+        return true;
+    }
+
+    EGLint eglWidth, eglHeight;
+    if (!m_queryWaylandBuffer(m_eglDisplay, buffer, EGL_WIDTH, &eglWidth)
+        || !m_queryWaylandBuffer(m_eglDisplay, buffer, EGL_HEIGHT, &eglHeight))
+        return false;
+
+    info.width = eglWidth;
+    info.height = eglHeight;
+    info.shm = false;
+    info.shmFormat = 0;
+    info.handle = vc_dispmanx_get_handle_from_wl_buffer(buffer);
+    return true;
+}
+
+void RPiBackend::changeElementSource(UpdateHandle update, ElementHandle element, struct wl_resource* buffer, const std::vector<Rect>& damage)
+{
+    if (struct wl_shm_buffer* shmBuffer = wl_shm_buffer_get(buffer)) {
+        attachShmBuffer(update, element, shmBuffer, damage);
+        return;
+    }
+
+    const BufferInfo* info = bufferInfo(buffer);
+    if (!info)
+        return;
+
+    releaseShmElement(update, element);
+    vc_dispmanx_element_change_source(update, element, info->handle);
+}
+
+static bool imageTypeForShmFormat(uint32_t format, VC_IMAGE_TYPE_T& type)
+{
+    switch (format) {
+    case WL_SHM_FORMAT_ARGB8888:
+        type = VC_IMAGE_ARGB8888;
+        return true;
+    case WL_SHM_FORMAT_XRGB8888:
+        type = VC_IMAGE_XRGB8888;
+        return true;
+    case WL_SHM_FORMAT_RGB565:
+        type = VC_IMAGE_RGB565;
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool RPiBackend::attachShmBuffer(UpdateHandle update, ElementHandle element, struct wl_shm_buffer* shmBuffer, const std::vector<Rect>& damage)
+{
+    VC_IMAGE_TYPE_T type;
+    if (!imageTypeForShmFormat(wl_shm_buffer_get_format(shmBuffer), type)) {
+        std::fprintf(stderr, "[Athol] Unsupported wl_shm format %u\n", wl_shm_buffer_get_format(shmBuffer));
+        return false;
+    }
+
+    int32_t width = wl_shm_buffer_get_width(shmBuffer);
+    int32_t height = wl_shm_buffer_get_height(shmBuffer);
+    int32_t stride = wl_shm_buffer_get_stride(shmBuffer);
+
+    auto it = m_shmElements.find(element);
+    if (it == m_shmElements.end())
+        it = m_shmElements.emplace(element, ShmElement()).first;
+
+    auto& shmElement = it->second;
+    unsigned back = shmElement.current ^ 1;
+    auto& resource = shmElement.resources[back];
+    uint64_t serial = serialOf(update);
+
+    // Completions can lag behind repaints, the back resource may well still
+    // be on screen.
+    bool fullUpload = shmElement.width != width || shmElement.height != height;
+    if (resource.handle == DISPMANX_NO_HANDLE || resource.type != type
+        || resource.width < uint32_t(width) || resource.height < uint32_t(height)
+        || shmElement.shownUntil[back] > m_completedUpdates.load()) {
+        retireResource(std::max(serial, shmElement.shownUntil[back]), resource);
+        resource = m_resourcePool.acquire(type, width, height);
+        if (resource.handle == DISPMANX_NO_HANDLE)
+            return false;
+        fullUpload = true;
+    }
+
+    std::vector<Rect> bands;
+    if (fullUpload) {
+        bands.push_back({ 0, 0, width, height });
+        shmElement.previousDamage = bands;
+    } else {
+        std::vector<Rect> frameDamage = damagedRows(damage, width, height);
+        if (frameDamage.empty())
+            return true;
+
+        bands = shmElement.previousDamage;
+        bands.insert(bands.end(), frameDamage.begin(), frameDamage.end());
+        bands = damagedRows(bands, width, height);
+        shmElement.previousDamage = std::move(frameDamage);
+    }
+    shmElement.width = width;
+    shmElement.height = height;
+
+    // Upload straight from the client's mapping of the pool. The dispmanx
+    // transfer works on whole rows, which is why damage is tracked in bands.
+    wl_shm_buffer_begin_access(shmBuffer);
+    auto* data = static_cast<uint8_t*>(wl_shm_buffer_get_data(shmBuffer));
+    for (auto& band : bands) {
+        VC_RECT_T rect;
+        vc_dispmanx_rect_set(&rect, 0, band.y, width, band.height);
+        vc_dispmanx_resource_write_data(resource.handle, type, stride, data, &rect);
+        m_uploadedBytes += uint64_t(stride) * band.height;
+    }
+    wl_shm_buffer_end_access(shmBuffer);
+
+    vc_dispmanx_element_change_source(update, element, resource.handle);
+    shmElement.shownUntil[shmElement.current] = serial;
+    shmElement.current = back;
+    return true;
+}
+
+void RPiBackend::releaseShmElement(UpdateHandle update, ElementHandle element)
+{
+    auto it = m_shmElements.find(element);
+    if (it == m_shmElements.end())
+        return;
+
+    for (auto& resource : it->second.resources)
+        retireResource(serialOf(update), resource);
+    m_shmElements.erase(it);
+}
+
+uint64_t RPiBackend::serialOf(UpdateHandle update) const
+{
+    for (auto& openUpdate : m_openUpdates) {
+        if (openUpdate.handle == update)
+            return openUpdate.serial;
+    }
+    return m_startedUpdates;
+}
+
+void RPiBackend::retireResource(uint64_t serial, ResourcePool::Resource& resource)
+{
+    if (resource.handle == DISPMANX_NO_HANDLE)
+        return;
+
+    m_retiredResources.push_back({ resource, serial });
+    resource.handle = DISPMANX_NO_HANDLE;
+}
+
+void RPiBackend::releaseRetiredResources()
+{
+    uint64_t completed = m_completedUpdates.load();
+    auto it = m_retiredResources.begin();
+    while (it != m_retiredResources.end()) {
+        if (it->serial > completed) {
+            ++it;
+            continue;
+        }
+
+        m_resourcePool.release(it->resource);
+        it = m_retiredResources.erase(it);
+    }
+}
+
+static uint32_t bucketSize(uint32_t size)
+{
+    return (size + 63) & ~63u;
+}
+
+RPiBackend::ResourcePool::~ResourcePool()
+{
+    for (auto& resource : m_freeResources)
+        vc_dispmanx_resource_delete(resource.handle);
+}
+
+RPiBackend::ResourcePool::Resource RPiBackend::ResourcePool::acquire(VC_IMAGE_TYPE_T type, uint32_t width, uint32_t height)
+{
+    width = bucketSize(width);
+    height = bucketSize(height);
+
+    for (auto it = m_freeResources.begin(); it != m_freeResources.end(); ++it) {
+        if (it->type == type && it->width == width && it->height == height) {
+            Resource resource = *it;
+            m_freeResources.erase(it);
+            return resource;
+        }
+    }
+
+    uint32_t imagePtr;
+    Resource resource = { vc_dispmanx_resource_create(type, width, height, &imagePtr), type, width, height };
+    return resource;
+}
+
+void RPiBackend::ResourcePool::release(Resource& resource)
+{
+    if (resource.handle == DISPMANX_NO_HANDLE)
+        return;
+
+    // Keep the most recently released resources, they are the likeliest to
+    // match the next request.
+    if (m_freeResources.size() == s_maxFreeResources) {
+        vc_dispmanx_resource_delete(m_freeResources.front().handle);
+        m_freeResources.erase(m_freeResources.begin());
+    }
+
+    m_freeResources.push_back(resource);
+    resource.handle = DISPMANX_NO_HANDLE;
+}
+
+void RPiBackend::updateComplete(DISPMANX_UPDATE_HANDLE_T, void* data)
+{
+    auto& backend = *static_cast<RPiBackend*>(data);
+    ++backend.m_completedUpdates;
+    backend.m_completionCallback(backend.m_completionData);
+}
+
+void RPiBackend::vsync(DISPMANX_UPDATE_HANDLE_T, void* data)
+{
+    auto& backend = *static_cast<RPiBackend*>(data);
+    backend.m_vblankCallback(backend.m_vblankData);
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RPiBackend_h
+#define RPiBackend_h
+
+#include "Backend.h"
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <wayland-egl.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#define BUILD_WAYLAND
+#include <bcm_host.h>
+
+class RPiBackend final : public Backend {
+public:
+    // "hdmi" by default, or "lcd" for the DSI touchscreen.
+    RPiBackend(const char* output);
+    virtual ~RPiBackend();
+
+    virtual bool initialize(CompletionCallback, void*) override;
+    virtual void bindDisplay(struct wl_display*) override;
+
+    virtual uint32_t width() const override { return m_width; }
+    virtual uint32_t height() const override { return m_height; }
+
+    virtual void setVblankCallback(VblankCallback, void*) override;
+
+    virtual UpdateHandle startUpdate() override;
+    virtual void submitUpdate(UpdateHandle) override;
+
+    virtual ResourceHandle createResource(uint32_t width, uint32_t height, const void* pixels, uint32_t stride) override;
+    virtual void deleteResource(ResourceHandle) override;
+
+    virtual ElementHandle addElement(UpdateHandle, int32_t layer, ResourceHandle, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination, bool opaque) override;
+    virtual void removeElement(UpdateHandle, ElementHandle) override;
+    virtual void changeElementAttributes(UpdateHandle, ElementHandle, int32_t layer, uint32_t sourceWidth, uint32_t sourceHeight, const Rect& destination) override;
+
+    virtual void changeElementSource(UpdateHandle, ElementHandle, struct wl_resource* buffer, const std::vector<Rect>& damage) override;
+
+    virtual uint64_t uploadedBytes() const override { return m_uploadedBytes; }
+
+private:
+    virtual bool queryBufferInfo(struct wl_resource*, BufferInfo&) override;
+
+    static void updateComplete(DISPMANX_UPDATE_HANDLE_T, void*);
+    static void vsync(DISPMANX_UPDATE_HANDLE_T, void*);
+
+    // Creating dispmanx resources is expensive on the VideoCore, so the ones
+    // backing wl_shm buffers are recycled. Sizes are rounded up to buckets so
+    // that buffers of slightly different sizes can share resources.
+    class ResourcePool {
+    public:
+        struct Resource {
+            DISPMANX_RESOURCE_HANDLE_T handle;
+            VC_IMAGE_TYPE_T type;
+            uint32_t width;
+            uint32_t height;
+        };
+
+        ~ResourcePool();
+
+        Resource acquire(VC_IMAGE_TYPE_T, uint32_t width, uint32_t height);
+        void release(Resource&);
+
+    private:
+        static const size_t s_maxFreeResources = 8;
+        std::vector<Resource> m_freeResources;
+    };
+
+    // Each shm-backed element flips between two resources so that the one
+    // being scanned out is never written to. The other one therefore also
+    // misses the previous frame's damage, which is uploaded again. The back
+    // resource is only written once the update that took it off the screen,
+    // by its serial, has completed, or it is swapped for a fresh one.
+    struct ShmElement {
+        ResourcePool::Resource resources[2];
+        uint64_t shownUntil[2];
+        unsigned current;
+        int32_t width;
+        int32_t height;
+        std::vector<Rect> previousDamage;
+    };
+
+    bool attachShmBuffer(UpdateHandle, ElementHandle, struct wl_shm_buffer*, const std::vector<Rect>& damage);
+    void releaseShmElement(UpdateHandle, ElementHandle);
+
+    // Updates are numbered as they start. The outputs submit them in that
+    // order, which is also the order dispmanx completes them in.
+    struct OpenUpdate {
+        UpdateHandle handle;
+        uint64_t serial;
+    };
+    uint64_t serialOf(UpdateHandle) const;
+
+    // A resource dropped by an update may still be scanned out until that
+    // update completes, so it only goes back to the pool afterwards.
+    struct RetiredResource {
+        ResourcePool::Resource resource;
+        uint64_t serial;
+    };
+
+    void retireResource(uint64_t serial, ResourcePool::Resource&);
+    void releaseRetiredResources();
+
+    using BindDisplayType = PFNEGLBINDWAYLANDDISPLAYWL;
+    BindDisplayType m_bindDisplay;
+
+    using QueryWaylandBufferType = PFNEGLQUERYWAYLANDBUFFERWL;
+    QueryWaylandBufferType m_queryWaylandBuffer;
+
+    CompletionCallback m_completionCallback;
+    void* m_completionData;
+
+    VblankCallback m_vblankCallback;
+    void* m_vblankData;
+
+    EGLDisplay m_eglDisplay;
+    std::string m_output;
+    DISPMANX_DISPLAY_HANDLE_T m_displayHandle;
+
+    uint32_t m_width;
+    uint32_t m_height;
+
+    ResourcePool m_resourcePool;
+    uint64_t m_uploadedBytes;
+    std::unordered_map<ElementHandle, ShmElement> m_shmElements;
+
+    std::vector<RetiredResource> m_retiredResources;
+    std::vector<OpenUpdate> m_openUpdates;
+    uint64_t m_startedUpdates;
+    // Counted on the dispmanx thread.
+    std::atomic<uint64_t> m_completedUpdates;
+};
+
+#endif // RPiBackend_h
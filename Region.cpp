@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Region.h"
+
+#include <algorithm>
+#include <utility>
+
+Region::Region()
+    : m_extents({ 0, 0, 0, 0 })
+{
+}
+
+Region::Region(const Rect& rect)
+    : m_extents(toBox(rect))
+{
+}
+
+Region Region::infinite()
+{
+    Region region;
+    region.m_extents = { INT32_MIN, INT32_MIN, INT32_MAX, INT32_MAX };
+    return region;
+}
+
+// Clips the right and bottom edges so that they do not overflow. Empty
+// rectangles all become the same empty box.
+Region::Box Region::toBox(const Rect& rect)
+{
+    if (rect.width <= 0 || rect.height <= 0)
+        return { 0, 0, 0, 0 };
+
+    Box box = { rect.x, rect.y,
+        int32_t(std::min<int64_t>(int64_t(rect.x) + rect.width, INT32_MAX)),
+        int32_t(std::min<int64_t>(int64_t(rect.y) + rect.height, INT32_MAX)) };
+    if (box.x1 >= box.x2 || box.y1 >= box.y2)
+        return { 0, 0, 0, 0 };
+    return box;
+}
+
+Region::Rect Region::toRect(const Box& box)
+{
+    return { box.x1, box.y1,
+        int32_t(std::min<int64_t>(int64_t(box.x2) - box.x1, INT32_MAX)),
+        int32_t(std::min<int64_t>(int64_t(box.y2) - box.y1, INT32_MAX)) };
+}
+
+bool Region::covers(const Box& a, const Box& b)
+{
+    return a.x1 <= b.x1 && a.y1 <= b.y1 && a.x2 >= b.x2 && a.y2 >= b.y2;
+}
+
+bool Region::overlaps(const Box& a, const Box& b)
+{
+    return a.x1 < b.x2 && b.x1 < a.x2 && a.y1 < b.y2 && b.y1 < a.y2;
+}
+
+const Region::Box* Region::bandEnd(const Box* box, const Box* end)
+{
+    const Box* it = box;
+    while (it != end && it->y1 == box->y1)
+        ++it;
+    return it;
+}
+
+void Region::setBox(const Box& box)
+{
+    m_extents = box.x1 < box.x2 && box.y1 < box.y2 ? box : Box { 0, 0, 0, 0 };
+    m_boxes.clear();
+}
+
+void Region::setBoxes(std::vector<Box>&& boxes)
+{
+    if (boxes.size() <= 1) {
+        setBox(boxes.empty() ? Box { 0, 0, 0, 0 } : boxes.front());
+        return;
+    }
+
+    m_extents = { boxes.front().x1, boxes.front().y1, boxes.front().x2, boxes.back().y2 };
+    for (auto& box : boxes) {
+        m_extents.x1 = std::min(m_extents.x1, box.x1);
+        m_extents.x2 = std::max(m_extents.x2, box.x2);
+    }
+    m_boxes = std::move(boxes);
+}
+
+// Sweeps the columns of one band of each region, a and b, from left to
+// right, and appends the spans that the operation keeps.
+void Region::combineBand(const Box* a, const Box* aEnd, const Box* b, const Box* bEnd,
+    Operation operation, int32_t y1, int32_t y2, std::vector<Box>& boxes)
+{
+    bool inA = false;
+    bool inB = false;
+    bool inside = false;
+    int32_t start = 0;
+    while (a != aEnd || b != bEnd) {
+        int32_t x = INT32_MAX;
+        if (a != aEnd)
+            x = std::min(x, inA ? a->x2 : a->x1);
+        if (b != bEnd)
+            x = std::min(x, inB ? b->x2 : b->x1);
+
+        // Edges at the same column are crossed together, so that spans that
+        // touch come out as one.
+        if (a != aEnd && x == (inA ? a->x2 : a->x1)) {
+            if (inA)
+                ++a;
+            inA = !inA;
+        }
+        if (b != bEnd && x == (inB ? b->x2 : b->x1)) {
+            if (inB)
+                ++b;
+            inB = !inB;
+        }
+
+        bool keep;
+        switch (operation) {
+        case Operation::Union:
+            keep = inA || inB;
+            break;
+        case Operation::Intersection:
+            keep = inA && inB;
+            break;
+        case Operation::Difference:
+        default:
+            keep = inA && !inB;
+            break;
+        }
+
+        if (keep && !inside)
+            start = x;
+        else if (!keep && inside)
+            boxes.push_back({ start, y1, x, y2 });
+        inside = keep;
+    }
+}
+
+// Sweeps both regions from top to bottom, cutting them into bands wherever
+// either has an edge, and merges each band with the one above it when they
+// have the same columns.
+void Region::combine(const Region& other, Operation operation)
+{
+    std::vector<Box> boxes;
+    boxes.reserve(rectCount() + other.rectCount());
+
+    size_t previousBand = 0;
+    size_t previousBandSize = 0;
+
+    const Box* a = begin();
+    const Box* aEnd = end();
+    const Box* b = other.begin();
+    const Box* bEnd = other.end();
+    int32_t y = std::min(a != aEnd ? a->y1 : INT32_MAX, b != bEnd ? b->y1 : INT32_MAX);
+    while (a != aEnd || b != bEnd) {
+        if (operation != Operation::Union && a == aEnd)
+            break;
+        if (operation == Operation::Intersection && b == bEnd)
+            break;
+
+        bool inA = a != aEnd && a->y1 <= y;
+        bool inB = b != bEnd && b->y1 <= y;
+        if (!inA && !inB) {
+            y = std::min(a != aEnd ? a->y1 : INT32_MAX, b != bEnd ? b->y1 : INT32_MAX);
+            continue;
+        }
+
+        int32_t bottom = INT32_MAX;
+        if (a != aEnd)
+            bottom = std::min(bottom, inA ? a->y2 : a->y1);
+        if (b != bEnd)
+            bottom = std::min(bottom, inB ? b->y2 : b->y1);
+
+        const Box* aBandEnd = inA ? bandEnd(a, aEnd) : a;
+        const Box* bBandEnd = inB ? bandEnd(b, bEnd) : b;
+        size_t band = boxes.size();
+        combineBand(a, aBandEnd, b, bBandEnd, operation, y, bottom, boxes);
+
+        size_t bandSize = boxes.size() - band;
+        if (bandSize && bandSize == previousBandSize && boxes[previousBand].y2 == y
+            && std::equal(boxes.begin() + band, boxes.end(), boxes.begin() + previousBand,
+                [](const Box& a, const Box& b) { return a.x1 == b.x1 && a.x2 == b.x2; })) {
+            for (size_t i = previousBand; i < band; ++i)
+                boxes[i].y2 = bottom;
+            boxes.resize(band);
+        } else if (bandSize) {
+            previousBand = band;
+            previousBandSize = bandSize;
+        }
+
+        y = bottom;
+        if (inA && a->y2 == bottom)
+            a = aBandEnd;
+        if (inB && b->y2 == bottom)
+            b = bBandEnd;
+    }
+
+    setBoxes(std::move(boxes));
+}
+
+void Region::unite(const Rect& rect)
+{
+    unite(Region(rect));
+}
+
+void Region::unite(const Region& region)
+{
+    if (region.isEmpty())
+        return;
+    if (isEmpty() || (region.m_boxes.empty() && covers(region.m_extents, m_extents))) {
+        *this = region;
+        return;
+    }
+    if (m_boxes.empty() && covers(m_extents, region.m_extents))
+        return;
+
+    combine(region, Operation::Union);
+}
+
+void Region::subtract(const Rect& rect)
+{
+    subtract(Region(rect));
+}
+
+void Region::subtract(const Region& region)
+{
+    if (isEmpty() || region.isEmpty() || !overlaps(m_extents, region.m_extents))
+        return;
+    if (region.m_boxes.empty() && covers(region.m_extents, m_extents)) {
+        setBox({ 0, 0, 0, 0 });
+        return;
+    }
+
+    combine(region, Operation::Difference);
+}
+
+void Region::intersect(const Rect& rect)
+{
+    intersect(Region(rect));
+}
+
+void Region::intersect(const Region& region)
+{
+    if (isEmpty())
+        return;
+    if (region.isEmpty() || !overlaps(m_extents, region.m_extents)) {
+        setBox({ 0, 0, 0, 0 });
+        return;
+    }
+    if (m_boxes.empty() && region.m_boxes.empty()) {
+        setBox({ std::max(m_extents.x1, region.m_extents.x1), std::max(m_extents.y1, region.m_extents.y1),
+            std::min(m_extents.x2, region.m_extents.x2), std::min(m_extents.y2, region.m_extents.y2) });
+        return;
+    }
+    if (region.m_boxes.empty() && covers(region.m_extents, m_extents))
+        return;
+    if (m_boxes.empty() && covers(m_extents, region.m_extents)) {
+        *this = region;
+        return;
+    }
+
+    combine(region, Operation::Intersection);
+}
+
+void Region::translate(int32_t dx, int32_t dy)
+{
+    if (isEmpty())
+        return;
+
+    // Clipped to the coordinate space, which only ever shrinks boxes, so
+    // the bands keep their order.
+    auto translated = [dx, dy](const Box& box) -> Box {
+        auto clamp = [](int64_t value) { return int32_t(std::min<int64_t>(std::max<int64_t>(value, INT32_MIN), INT32_MAX)); };
+        return { clamp(int64_t(box.x1) + dx), clamp(int64_t(box.y1) + dy),
+            clamp(int64_t(box.x2) + dx), clamp(int64_t(box.y2) + dy) };
+    };
+
+    if (m_boxes.empty()) {
+        setBox(translated(m_extents));
+        return;
+    }
+
+    std::vector<Box> boxes;
+    boxes.reserve(m_boxes.size());
+    for (auto& box : m_boxes) {
+        Box moved = translated(box);
+        if (moved.x1 < moved.x2 && moved.y1 < moved.y2)
+            boxes.push_back(moved);
+    }
+    setBoxes(std::move(boxes));
+}
+
+bool Region::contains(const Rect& rect) const
+{
+    Box box = toBox(rect);
+    if (box.x1 >= box.x2)
+        return true;
+    if (!covers(m_extents, box))
+        return false;
+    if (m_boxes.empty())
+        return true;
+
+    // Every band across the rows of the rect has to have one box that spans
+    // its columns, with no gap between the bands.
+    const Box* it = std::upper_bound(begin(), end(), box.y1,
+        [](int32_t y, const Box& band) { return y < band.y2; });
+    int32_t y = box.y1;
+    while (y < box.y2) {
+        if (it == end() || it->y1 > y)
+            return false;
+
+        const Box* next = bandEnd(it, end());
+        if (!std::any_of(it, next, [&box](const Box& span) { return span.x1 <= box.x1 && span.x2 >= box.x2; }))
+            return false;
+        y = it->y2;
+        it = next;
+    }
+    return true;
+}
+
+bool Region::contains(int32_t x, int32_t y) const
+{
+    if (x < m_extents.x1 || x >= m_extents.x2 || y < m_extents.y1 || y >= m_extents.y2)
+        return false;
+    if (m_boxes.empty())
+        return true;
+
+    // Boxes are sorted by their top and left edges, so the one holding the
+    // point, if any, is the last one starting above and left of it in the
+    // band that holds its row.
+    auto band = std::upper_bound(m_boxes.begin(), m_boxes.end(), y,
+        [](int32_t y, const Box& box) { return y < box.y2; });
+    if (band == m_boxes.end() || band->y1 > y)
+        return false;
+
+    auto span = std::upper_bound(band, m_boxes.end(), std::make_pair(band->y1, x),
+        [](const std::pair<int32_t, int32_t>& point, const Box& box) {
+            return point.first < box.y1 || (point.first == box.y1 && point.second < box.x1);
+        });
+    return span != band && x < (span - 1)->x2;
+}
+
+const Region* Region::fromResource(struct wl_resource* resource)
+{
+    if (!resource)
+        return nullptr;
+    return static_cast<Region*>(wl_resource_get_user_data(resource));
+}
+
+void Region::createResource(struct wl_client* client, struct wl_resource* compositorResource, uint32_t id)
+{
+    struct wl_resource* resource = wl_resource_create(client, &wl_region_interface,
+        wl_resource_get_version(compositorResource), id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &m_regionInterface, new Region,
+        [](struct wl_resource* resource) {
+            delete static_cast<Region*>(wl_resource_get_user_data(resource));
+        });
+}
+
+const struct wl_region_interface Region::m_regionInterface = {
+    // destroy
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    },
+    // add
+    [](struct wl_client*, struct wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
+    {
+        static_cast<Region*>(wl_resource_get_user_data(resource))->unite({ x, y, width, height });
+    },
+    // subtract
+    [](struct wl_client*, struct wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
+    {
+        static_cast<Region*>(wl_resource_get_user_data(resource))->subtract({ x, y, width, height });
+    }
+};
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Region_h
+#define Region_h
+
+#include "Backend.h"
+#include <cstdint>
+#include <vector>
+#include <wayland-server.h>
+
+// A set of pixels, kept as rectangles sorted in horizontal bands, as in
+// pixman and X: the rectangles of a band span the same rows, are sorted left
+// to right and neither overlap nor touch, bands are sorted top to bottom, and
+// adjacent bands with the same columns are merged. A region of one rectangle
+// is held in its extents alone, without any allocation.
+class Region {
+public:
+    using Rect = Backend::Rect;
+
+    Region();
+    explicit Region(const Rect&);
+
+    // Everything, the default input region of a surface.
+    static Region infinite();
+
+    bool isEmpty() const { return m_extents.x1 >= m_extents.x2; }
+    Rect extents() const { return toRect(m_extents); }
+    size_t rectCount() const { return m_boxes.empty() ? !isEmpty() : m_boxes.size(); }
+
+    // Calls functor(const Rect&) for each rectangle, top to bottom and left
+    // to right.
+    template<typename Functor>
+    void forEachRect(const Functor& functor) const
+    {
+        if (m_boxes.empty()) {
+            if (!isEmpty())
+                functor(toRect(m_extents));
+            return;
+        }
+        for (auto& box : m_boxes)
+            functor(toRect(box));
+    }
+
+    void unite(const Rect&);
+    void unite(const Region&);
+    void subtract(const Rect&);
+    void subtract(const Region&);
+    void intersect(const Rect&);
+    void intersect(const Region&);
+    void translate(int32_t dx, int32_t dy);
+
+    bool contains(const Rect&) const;
+
+    // In O(log n) of the number of rectangles.
+    bool contains(int32_t x, int32_t y) const;
+
+    // The region held by a wl_region resource, or null for a null resource.
+    static const Region* fromResource(struct wl_resource*);
+    static void createResource(struct wl_client*, struct wl_resource*, uint32_t);
+
+private:
+    static const struct wl_region_interface m_regionInterface;
+
+    // Edges rather than sizes, so that the band operations compare them
+    // directly. Right and bottom edges are excluded.
+    struct Box {
+        int32_t x1;
+        int32_t y1;
+        int32_t x2;
+        int32_t y2;
+    };
+    static Box toBox(const Rect&);
+    static Rect toRect(const Box&);
+    static bool covers(const Box&, const Box&);
+    static bool overlaps(const Box&, const Box&);
+    static const Box* bandEnd(const Box*, const Box* end);
+
+    enum class Operation { Union, Intersection, Difference };
+    void combine(const Region&, Operation);
+    static void combineBand(const Box* a, const Box* aEnd, const Box* b, const Box* bEnd,
+        Operation, int32_t y1, int32_t y2, std::vector<Box>&);
+    void setBoxes(std::vector<Box>&&);
+    void setBox(const Box&);
+
+    const Box* begin() const { return m_boxes.empty() ? &m_extents : m_boxes.data(); }
+    const Box* end() const { return m_boxes.empty() ? &m_extents + !isEmpty() : m_boxes.data() + m_boxes.size(); }
+
+    // The bounding box, and the rectangles once there are more than one.
+    Box m_extents;
+    std::vector<Box> m_boxes;
+};
+
+#endif // Region_h
@@ -0,0 +1,535 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Seat.h"
+
+#include "Athol.h"
+#include "Cursor.h"
+#include "Output.h"
+#include "Startup.h"
+#include "Surface.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// Older C libraries have neither memfd_create() nor the sealing constants.
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+
+static const uint32_t s_seatVersion = 4;
+static const int32_t s_repeatRate = 25;
+static const int32_t s_repeatDelay = 600;
+
+Seat::Seat(Athol& athol)
+    : m_athol(athol)
+    , m_display(nullptr)
+    , m_global(nullptr)
+    , m_pressedButtons(0)
+    , m_pointerX(0)
+    , m_pointerY(0)
+    , m_xkbContext(nullptr)
+    , m_keymap(nullptr)
+    , m_xkbState(nullptr)
+    , m_keymapFd(-1)
+    , m_keymapSize(0)
+{
+    wl_list_init(&m_pointerResources);
+    wl_list_init(&m_keyboardResources);
+
+    for (Focus* focus : { &m_pointerFocus, &m_keyboardFocus }) {
+        focus->surface = nullptr;
+        focus->serial = 0;
+        focus->destroyListener.notify = focusDestroyed;
+        wl_list_init(&focus->destroyListener.link);
+    }
+
+    std::memset(&m_modifiers, 0, sizeof(m_modifiers));
+}
+
+Seat::~Seat()
+{
+    wl_list_remove(&m_pointerFocus.destroyListener.link);
+    wl_list_remove(&m_keyboardFocus.destroyListener.link);
+
+    if (m_keymapFd != -1)
+        close(m_keymapFd);
+    if (m_xkbState)
+        xkb_state_unref(m_xkbState);
+    if (m_keymap)
+        xkb_keymap_unref(m_keymap);
+    if (m_xkbContext)
+        xkb_context_unref(m_xkbContext);
+}
+
+bool Seat::initialize(struct wl_display* display)
+{
+    m_display = display;
+    m_global = wl_global_create(display, &wl_seat_interface, s_seatVersion, this, bindSeatInterface);
+    return !!m_global;
+}
+
+// A memfd that can no longer be written, resized or unsealed, so that the
+// same file can be handed to every client.
+static int createSealedFile(const char* name, const char* data, size_t size)
+{
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    int fd = -1;
+    errno = ENOSYS;
+#endif
+    if (fd == -1)
+        return -1;
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t ret = write(fd, data + written, size - written);
+        if (ret == -1 && errno == EINTR)
+            continue;
+        if (ret <= 0) {
+            close(fd);
+            return -1;
+        }
+        written += ret;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool Seat::compileKeymap()
+{
+    Startup::Phase phase("keymap");
+
+    m_xkbContext = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!m_xkbContext) {
+        std::fprintf(stderr, "[Athol] Failed to create the xkb context.\n");
+        return false;
+    }
+
+    m_keymap = xkb_keymap_new_from_names(m_xkbContext, nullptr, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!m_keymap) {
+        std::fprintf(stderr, "[Athol] Failed to compile the keymap.\n");
+        return false;
+    }
+    m_xkbState = xkb_state_new(m_keymap);
+
+    char* keymap = xkb_keymap_get_as_string(m_keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    if (!keymap) {
+        std::fprintf(stderr, "[Athol] Failed to serialize the keymap.\n");
+        return false;
+    }
+
+    // The size includes the terminating null byte.
+    m_keymapSize = std::strlen(keymap) + 1;
+    m_keymapFd = createSealedFile("athol-keymap", keymap, m_keymapSize);
+    std::free(keymap);
+    if (m_keymapFd == -1) {
+        std::fprintf(stderr, "[Athol] Failed to create the keymap file: %s\n", std::strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void Seat::bindSeatInterface(struct wl_client* client, void* data, uint32_t version, uint32_t id)
+{
+    struct wl_resource* resource = wl_resource_create(client, &wl_seat_interface, std::min(version, s_seatVersion), id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &m_seatInterface, data, nullptr);
+    wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_POINTER | WL_SEAT_CAPABILITY_KEYBOARD);
+    if (wl_resource_get_version(resource) >= WL_SEAT_NAME_SINCE_VERSION)
+        wl_seat_send_name(resource, "seat0");
+}
+
+static void removeResource(struct wl_resource* resource)
+{
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
+static const struct wl_touch_interface s_touchInterface = {
+    // release
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    }
+};
+
+const struct wl_seat_interface Seat::m_seatInterface = {
+    // get_pointer
+    [](struct wl_client* client, struct wl_resource* resource, uint32_t id)
+    {
+        auto& seat = *static_cast<Seat*>(wl_resource_get_user_data(resource));
+        struct wl_resource* pointer = wl_resource_create(client, &wl_pointer_interface, wl_resource_get_version(resource), id);
+        if (!pointer) {
+            wl_client_post_no_memory(client);
+            return;
+        }
+        wl_resource_set_implementation(pointer, &m_pointerInterface, &seat, removeResource);
+        wl_list_insert(&seat.m_pointerResources, wl_resource_get_link(pointer));
+
+        struct wl_resource* focus = seat.m_pointerFocus.surface;
+        if (focus && wl_resource_get_client(focus) == client)
+            wl_pointer_send_enter(pointer, seat.m_pointerFocus.serial, focus, seat.m_pointerX, seat.m_pointerY);
+    },
+    // get_keyboard
+    [](struct wl_client* client, struct wl_resource* resource, uint32_t id)
+    {
+        auto& seat = *static_cast<Seat*>(wl_resource_get_user_data(resource));
+        struct wl_resource* keyboard = wl_resource_create(client, &wl_keyboard_interface, wl_resource_get_version(resource), id);
+        if (!keyboard) {
+            wl_client_post_no_memory(client);
+            return;
+        }
+        wl_resource_set_implementation(keyboard, &m_keyboardInterface, &seat, removeResource);
+        wl_list_insert(&seat.m_keyboardResources, wl_resource_get_link(keyboard));
+
+        seat.sendKeymap(keyboard);
+        if (wl_resource_get_version(keyboard) >= WL_KEYBOARD_REPEAT_INFO_SINCE_VERSION)
+            wl_keyboard_send_repeat_info(keyboard, s_repeatRate, s_repeatDelay);
+
+        struct wl_resource* focus = seat.m_keyboardFocus.surface;
+        if (focus && wl_resource_get_client(focus) == client)
+            seat.sendKeyboardEnter(keyboard);
+    },
+    // get_touch
+    [](struct wl_client* client, struct wl_resource* resource, uint32_t id)
+    {
+        // There is no touch capability, the resource never gets any event.
+        struct wl_resource* touch = wl_resource_create(client, &wl_touch_interface, wl_resource_get_version(resource), id);
+        if (!touch) {
+            wl_client_post_no_memory(client);
+            return;
+        }
+        wl_resource_set_implementation(touch, &s_touchInterface, nullptr, nullptr);
+    },
+    // release
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    }
+};
+
+const struct wl_pointer_interface Seat::m_pointerInterface = {
+    // set_cursor
+    [](struct wl_client* client, struct wl_resource* resource, uint32_t serial, struct wl_resource* surfaceResource, int32_t hotspotX, int32_t hotspotY)
+    {
+        auto& seat = *static_cast<Seat*>(wl_resource_get_user_data(resource));
+
+        // Only the client with the pointer focus, from its enter on.
+        struct wl_resource* focus = seat.m_pointerFocus.surface;
+        if (!focus || wl_resource_get_client(focus) != client || serial - seat.m_pointerFocus.serial > UINT32_MAX / 2)
+            return;
+
+        Surface* surface = surfaceResource ? Surface::fromResource(surfaceResource) : nullptr;
+        if (surface && surface->subsurface()) {
+            wl_resource_post_error(resource, WL_POINTER_ERROR_ROLE,
+                "wl_surface@%u already has another role", wl_resource_get_id(surfaceResource));
+            return;
+        }
+
+        // There is no protocol error for it, the request is ignored.
+        if (surface && surface->hasSubsurfaces()) {
+            std::fprintf(stderr, "[Athol] wl_surface@%u has subsurfaces and cannot be a cursor\n", wl_resource_get_id(surfaceResource));
+            return;
+        }
+
+        seat.m_athol.setCursor(surfaceResource, hotspotX, hotspotY);
+    },
+    // release
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    }
+};
+
+const struct wl_keyboard_interface Seat::m_keyboardInterface = {
+    // release
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    }
+};
+
+void Seat::sendKeymap(struct wl_resource* keyboard)
+{
+    // The file is sealed, so it is shared rather than copied per client.
+    if (m_keymapFd != -1) {
+        wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, m_keymapFd, m_keymapSize);
+        return;
+    }
+
+    int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return;
+    wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_NO_KEYMAP, fd, 0);
+    close(fd);
+}
+
+void Seat::focusDestroyed(struct wl_listener* listener, void*)
+{
+    Focus* focus = wl_container_of(listener, focus, destroyListener);
+    wl_list_remove(&listener->link);
+    wl_list_init(&listener->link);
+    focus->surface = nullptr;
+}
+
+void Seat::setFocus(Focus& focus, struct wl_resource* surface)
+{
+    wl_list_remove(&focus.destroyListener.link);
+    wl_list_init(&focus.destroyListener.link);
+    focus.surface = surface;
+    if (surface)
+        wl_resource_add_destroy_listener(surface, &focus.destroyListener);
+}
+
+Surface* Seat::pick(double x, double y)
+{
+    Output* output = m_athol.cursor().output();
+    double outputX = x - output->x();
+
+    Surface* surface;
+    wl_list_for_each_reverse(surface, output->surfaceList(), stackLink) {
+        double surfaceX, surfaceY;
+        surface->toSurfaceCoordinates(outputX, y, surfaceX, surfaceY);
+        if (surface->acceptsInput(int32_t(std::floor(surfaceX)), int32_t(std::floor(surfaceY))))
+            return surface;
+    }
+    return nullptr;
+}
+
+void Seat::updatePointerFocus(uint32_t time)
+{
+    Cursor& cursor = m_athol.cursor();
+    Surface* surface = m_pressedButtons && m_pointerFocus.surface
+        ? Surface::fromResource(m_pointerFocus.surface) : pick(cursor.x(), cursor.y());
+
+    double surfaceX = 0;
+    double surfaceY = 0;
+    if (surface)
+        surface->toSurfaceCoordinates(cursor.x() - surface->output().x(), cursor.y(), surfaceX, surfaceY);
+    m_pointerX = wl_fixed_from_double(surfaceX);
+    m_pointerY = wl_fixed_from_double(surfaceY);
+
+    struct wl_resource* focus = surface ? surface->resource() : nullptr;
+    struct wl_resource* pointer;
+    if (focus == m_pointerFocus.surface) {
+        if (!focus)
+            return;
+        wl_resource_for_each(pointer, &m_pointerResources) {
+            if (wl_resource_get_client(pointer) == wl_resource_get_client(focus))
+                wl_pointer_send_motion(pointer, time, m_pointerX, m_pointerY);
+        }
+        return;
+    }
+
+    if (struct wl_resource* previous = m_pointerFocus.surface) {
+        uint32_t serial = wl_display_next_serial(m_display);
+        wl_resource_for_each(pointer, &m_pointerResources) {
+            if (wl_resource_get_client(pointer) == wl_resource_get_client(previous))
+                wl_pointer_send_leave(pointer, serial, previous);
+        }
+    }
+
+    setFocus(m_pointerFocus, focus);
+
+    // Each client sets its own cursor when the pointer enters its surfaces.
+    cursor.setDefault();
+    if (!focus)
+        return;
+
+    m_pointerFocus.serial = wl_display_next_serial(m_display);
+    wl_resource_for_each(pointer, &m_pointerResources) {
+        if (wl_resource_get_client(pointer) == wl_resource_get_client(focus))
+            wl_pointer_send_enter(pointer, m_pointerFocus.serial, focus, m_pointerX, m_pointerY);
+    }
+}
+
+void Seat::setKeyboardFocus(struct wl_resource* surface)
+{
+    if (surface == m_keyboardFocus.surface)
+        return;
+
+    struct wl_resource* keyboard;
+    if (struct wl_resource* previous = m_keyboardFocus.surface) {
+        uint32_t serial = wl_display_next_serial(m_display);
+        wl_resource_for_each(keyboard, &m_keyboardResources) {
+            if (wl_resource_get_client(keyboard) == wl_resource_get_client(previous))
+                wl_keyboard_send_leave(keyboard, serial, previous);
+        }
+    }
+
+    setFocus(m_keyboardFocus, surface);
+    if (!surface)
+        return;
+
+    wl_resource_for_each(keyboard, &m_keyboardResources) {
+        if (wl_resource_get_client(keyboard) == wl_resource_get_client(surface))
+            sendKeyboardEnter(keyboard);
+    }
+}
+
+void Seat::sendKeyboardEnter(struct wl_resource* keyboard)
+{
+    struct wl_array keys;
+    wl_array_init(&keys);
+    size_t size = m_pressedKeys.size() * sizeof(uint32_t);
+    if (size) {
+        if (void* data = wl_array_add(&keys, size))
+            std::memcpy(data, m_pressedKeys.data(), size);
+    }
+
+    wl_keyboard_send_enter(keyboard, wl_display_next_serial(m_display), m_keyboardFocus.surface, &keys);
+    wl_array_release(&keys);
+
+    wl_keyboard_send_modifiers(keyboard, wl_display_next_serial(m_display),
+        m_modifiers.depressed, m_modifiers.latched, m_modifiers.locked, m_modifiers.group);
+}
+
+void Seat::updateModifiers()
+{
+    if (!m_xkbState)
+        return;
+
+    Modifiers modifiers;
+    modifiers.depressed = xkb_state_serialize_mods(m_xkbState, XKB_STATE_MODS_DEPRESSED);
+    modifiers.latched = xkb_state_serialize_mods(m_xkbState, XKB_STATE_MODS_LATCHED);
+    modifiers.locked = xkb_state_serialize_mods(m_xkbState, XKB_STATE_MODS_LOCKED);
+    modifiers.group = xkb_state_serialize_layout(m_xkbState, XKB_STATE_LAYOUT_EFFECTIVE);
+    if (!std::memcmp(&modifiers, &m_modifiers, sizeof(modifiers)))
+        return;
+    m_modifiers = modifiers;
+
+    struct wl_resource* focus = m_keyboardFocus.surface;
+    if (!focus)
+        return;
+
+    uint32_t serial = wl_display_next_serial(m_display);
+    struct wl_resource* keyboard;
+    wl_resource_for_each(keyboard, &m_keyboardResources) {
+        if (wl_resource_get_client(keyboard) == wl_resource_get_client(focus))
+            wl_keyboard_send_modifiers(keyboard, serial, m_modifiers.depressed, m_modifiers.latched, m_modifiers.locked, m_modifiers.group);
+    }
+}
+
+void Seat::handleEvent(const API::InputEvent& event)
+{
+    ATHOL_TRACE_SCOPE("Seat::handleEvent");
+    struct wl_resource* resource;
+
+    switch (event.type) {
+    case API::InputEvent::PointerMotion:
+        updatePointerFocus(event.time);
+        break;
+    case API::InputEvent::PointerButton:
+    {
+        bool pressed = event.state == WL_POINTER_BUTTON_STATE_PRESSED;
+        if (pressed)
+            m_pressedButtons++;
+        else if (m_pressedButtons)
+            m_pressedButtons--;
+
+        struct wl_resource* focus = m_pointerFocus.surface;
+        if (focus) {
+            uint32_t serial = wl_display_next_serial(m_display);
+            wl_resource_for_each(resource, &m_pointerResources) {
+                if (wl_resource_get_client(resource) == wl_resource_get_client(focus))
+                    wl_pointer_send_button(resource, serial, event.time, event.button, event.state);
+            }
+
+            // Clicking a surface gives the keyboard to its top-level.
+            if (pressed) {
+                Surface* surface = Surface::fromResource(focus);
+                while (Surface* parent = surface->parent())
+                    surface = parent;
+                setKeyboardFocus(surface->resource());
+            }
+        }
+
+        // The pointer may have left the surface while the buttons were held.
+        if (!m_pressedButtons)
+            updatePointerFocus(event.time);
+        break;
+    }
+    case API::InputEvent::PointerAxis:
+    {
+        struct wl_resource* focus = m_pointerFocus.surface;
+        if (!focus)
+            break;
+        wl_resource_for_each(resource, &m_pointerResources) {
+            if (wl_resource_get_client(resource) == wl_resource_get_client(focus))
+                wl_pointer_send_axis(resource, event.time, event.axis, wl_fixed_from_double(event.value));
+        }
+        break;
+    }
+    case API::InputEvent::KeyboardKey:
+    {
+        bool pressed = event.state == WL_KEYBOARD_KEY_STATE_PRESSED;
+        auto key = std::find(m_pressedKeys.begin(), m_pressedKeys.end(), event.key);
+        if (pressed && key == m_pressedKeys.end())
+            m_pressedKeys.push_back(event.key);
+        else if (!pressed && key != m_pressedKeys.end())
+            m_pressedKeys.erase(key);
+
+        // evdev keycodes are offset by 8 in xkb.
+        if (m_xkbState)
+            xkb_state_update_key(m_xkbState, event.key + 8, pressed ? XKB_KEY_DOWN : XKB_KEY_UP);
+
+        if (struct wl_resource* focus = m_keyboardFocus.surface) {
+            uint32_t serial = wl_display_next_serial(m_display);
+            wl_resource_for_each(resource, &m_keyboardResources) {
+                if (wl_resource_get_client(resource) == wl_resource_get_client(focus))
+                    wl_keyboard_send_key(resource, serial, event.time, event.key, event.state);
+            }
+        }
+        updateModifiers();
+        break;
+    }
+    }
+}
@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Seat_h
+#define Seat_h
+
+#include <API/Interfaces.h>
+#include <cstdint>
+#include <vector>
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+
+class Athol;
+class Surface;
+
+// wl_seat, with a pointer and a keyboard. The pointer focuses the surface
+// under the cursor, and keeps it while buttons are held. The keyboard
+// focuses the surface set by the shell, or the last one clicked.
+class Seat {
+public:
+    Seat(Athol&);
+    ~Seat();
+
+    Seat(const Seat&) = delete;
+    Seat& operator=(const Seat&) = delete;
+
+    bool initialize(struct wl_display*);
+
+    // Compiles the keymap from the XKB_DEFAULT_* variables, on the startup
+    // thread. It is written once to a sealed memfd that every client maps,
+    // rather than copied out to each of them.
+    bool compileKeymap();
+
+    // Input events, after the cursor has moved for them.
+    void handleEvent(const API::InputEvent&);
+
+    // Takes a wl_surface resource, or null to focus nothing.
+    void setKeyboardFocus(struct wl_resource* surface);
+
+private:
+    static void bindSeatInterface(struct wl_client*, void*, uint32_t, uint32_t);
+    static const struct wl_seat_interface m_seatInterface;
+    static const struct wl_pointer_interface m_pointerInterface;
+    static const struct wl_keyboard_interface m_keyboardInterface;
+
+    Athol& m_athol;
+    struct wl_display* m_display;
+    struct wl_global* m_global;
+
+    struct wl_list m_pointerResources;
+    struct wl_list m_keyboardResources;
+
+    // The focused wl_surface resources, and listeners that drop the focus
+    // when they are destroyed.
+    struct Focus {
+        struct wl_resource* surface;
+        struct wl_listener destroyListener;
+        uint32_t serial;
+    };
+    Focus m_pointerFocus;
+    Focus m_keyboardFocus;
+    static void focusDestroyed(struct wl_listener*, void*);
+    static void setFocus(Focus&, struct wl_resource*);
+
+    // The topmost surface under the cursor that takes input there. While
+    // buttons are held, the pointer stays with the surface they were
+    // pressed on.
+    Surface* pick(double x, double y);
+    void updatePointerFocus(uint32_t time);
+    uint32_t m_pressedButtons;
+    wl_fixed_t m_pointerX;
+    wl_fixed_t m_pointerY;
+
+    void sendKeyboardEnter(struct wl_resource* keyboard);
+    void sendKeymap(struct wl_resource* keyboard);
+    void updateModifiers();
+    std::vector<uint32_t> m_pressedKeys;
+
+    struct xkb_context* m_xkbContext;
+    struct xkb_keymap* m_keymap;
+    struct xkb_state* m_xkbState;
+    int m_keymapFd;
+    uint32_t m_keymapSize;
+
+    struct Modifiers {
+        uint32_t depressed;
+        uint32_t latched;
+        uint32_t locked;
+        uint32_t group;
+    } m_modifiers;
+};
+
+#endif // Seat_h
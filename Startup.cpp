@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Startup.h"
+
+#include "FrameClock.h"
+#include <atomic>
+#include <cstdio>
+#include <time.h>
+#include <utility>
+
+namespace Startup {
+
+static std::atomic<uint64_t> s_start(0);
+
+static double sinceStart(uint64_t time)
+{
+    return (time - s_start.load(std::memory_order_relaxed)) / 1e6;
+}
+
+void begin()
+{
+    uint64_t start = FrameClock::now();
+    s_start = start;
+
+    // CLOCK_BOOTTIME keeps counting through suspend, unlike the monotonic
+    // clock everything else is timed with.
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    std::fprintf(stderr, "[Athol] Startup: began %.1f ms after boot\n", (ts.tv_sec * 1000000000ull + ts.tv_nsec) / 1e6);
+}
+
+void mark(const char* event)
+{
+    std::fprintf(stderr, "[Athol] Startup: %s at %.1f ms\n", event, sinceStart(FrameClock::now()));
+}
+
+void firstClientFrame()
+{
+    static bool reported = false;
+    if (reported)
+        return;
+    reported = true;
+    mark("first client frame submitted");
+}
+
+Phase::Phase(std::string name)
+    : m_name(std::move(name))
+    , m_start(FrameClock::now())
+{
+}
+
+Phase::~Phase()
+{
+    uint64_t end = FrameClock::now();
+    std::fprintf(stderr, "[Athol] Startup: %s took %.1f ms, done at %.1f ms\n",
+        m_name.c_str(), (end - m_start) / 1e6, sinceStart(end));
+}
+
+} // namespace Startup
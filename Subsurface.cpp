@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Subsurface.h"
+
+#include "Surface.h"
+
+bool Subsurface::initialize(struct wl_display* display)
+{
+    return !!wl_global_create(display, &wl_subcompositor_interface, 1, nullptr, bindSubcompositorInterface);
+}
+
+Subsurface::Subsurface(Surface& surface, Surface& parent, struct wl_client* client, uint32_t version, uint32_t id)
+    : m_surface(&surface)
+    , m_parent(&parent)
+    , m_synchronized(true)
+{
+    m_position.current = { 0, 0 };
+    m_position.pending = { 0, 0 };
+
+    m_resource = wl_resource_create(client, &wl_subsurface_interface, version, id);
+    wl_resource_set_implementation(m_resource, &m_subsurfaceInterface, this,
+        [](struct wl_resource* resource) {
+            delete static_cast<Subsurface*>(wl_resource_get_user_data(resource));
+        });
+
+    // Subsurfaces are shown on the display of their parent.
+    surface.setSubsurface(this);
+    surface.setOutput(parent.output());
+    parent.addSubsurface(surface);
+}
+
+Subsurface::~Subsurface()
+{
+    if (!m_surface)
+        return;
+
+    if (m_parent)
+        m_parent->removeSubsurface(*m_surface);
+    m_surface->setSubsurface(nullptr);
+}
+
+bool Subsurface::applyPosition()
+{
+    if (m_position.current.x == m_position.pending.x && m_position.current.y == m_position.pending.y)
+        return false;
+
+    m_position.current = m_position.pending;
+    return true;
+}
+
+bool Subsurface::isSynchronized() const
+{
+    return m_parent && (m_synchronized || m_parent->isSynchronized());
+}
+
+void Subsurface::surfaceDestroyed()
+{
+    if (m_parent)
+        m_parent->removeSubsurface(*m_surface);
+    m_surface = nullptr;
+    m_parent = nullptr;
+}
+
+void Subsurface::parentDestroyed()
+{
+    // The surface is unmapped, and stays around as a plain wl_surface.
+    m_parent = nullptr;
+    m_surface->unmap();
+}
+
+void Subsurface::bindSubcompositorInterface(struct wl_client* client, void*, uint32_t, uint32_t id)
+{
+    struct wl_resource* resource = wl_resource_create(client, &wl_subcompositor_interface, 1, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    wl_resource_set_implementation(resource, &m_subcompositorInterface, nullptr, nullptr);
+}
+
+const struct wl_subcompositor_interface Subsurface::m_subcompositorInterface = {
+    // destroy
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    },
+    // get_subsurface
+    [](struct wl_client* client, struct wl_resource* resource, uint32_t id, struct wl_resource* surfaceResource, struct wl_resource* parentResource)
+    {
+        Surface& surface = *Surface::fromResource(surfaceResource);
+        Surface& parent = *Surface::fromResource(parentResource);
+
+        if (surface.subsurface() || surface.cursor()) {
+            wl_resource_post_error(resource, WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE,
+                "wl_surface@%u already has a role", wl_resource_get_id(surfaceResource));
+            return;
+        }
+
+        // Cursor surfaces are out of the stack, they cannot bring children.
+        if (parent.cursor()) {
+            wl_resource_post_error(resource, WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE,
+                "wl_surface@%u is a cursor and cannot be a parent", wl_resource_get_id(parentResource));
+            return;
+        }
+
+        for (Surface* ancestor = &parent; ancestor; ancestor = ancestor->parent()) {
+            if (ancestor == &surface) {
+                wl_resource_post_error(resource, WL_SUBCOMPOSITOR_ERROR_BAD_SURFACE,
+                    "wl_surface@%u cannot be its own ancestor", wl_resource_get_id(surfaceResource));
+                return;
+            }
+        }
+
+        new Subsurface(surface, parent, client, wl_resource_get_version(resource), id);
+    }
+};
+
+void Subsurface::place(struct wl_resource* resource, struct wl_resource* siblingResource, bool above)
+{
+    auto& subsurface = *static_cast<Subsurface*>(wl_resource_get_user_data(resource));
+    if (!subsurface.m_parent)
+        return;
+
+    Surface& sibling = *Surface::fromResource(siblingResource);
+    if (!subsurface.m_parent->placeSubsurface(*subsurface.m_surface, sibling, above)) {
+        wl_resource_post_error(resource, WL_SUBSURFACE_ERROR_BAD_SURFACE,
+            "wl_surface@%u is neither a sibling nor the parent", wl_resource_get_id(siblingResource));
+    }
+}
+
+const struct wl_subsurface_interface Subsurface::m_subsurfaceInterface = {
+    // destroy
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        wl_resource_destroy(resource);
+    },
+    // set_position
+    [](struct wl_client*, struct wl_resource* resource, int32_t x, int32_t y)
+    {
+        auto& subsurface = *static_cast<Subsurface*>(wl_resource_get_user_data(resource));
+        subsurface.m_position.pending = { x, y };
+    },
+    // place_above
+    [](struct wl_client*, struct wl_resource* resource, struct wl_resource* siblingResource)
+    {
+        place(resource, siblingResource, true);
+    },
+    // place_below
+    [](struct wl_client*, struct wl_resource* resource, struct wl_resource* siblingResource)
+    {
+        place(resource, siblingResource, false);
+    },
+    // set_sync
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        auto& subsurface = *static_cast<Subsurface*>(wl_resource_get_user_data(resource));
+        subsurface.m_synchronized = true;
+    },
+    // set_desync
+    [](struct wl_client*, struct wl_resource* resource)
+    {
+        auto& subsurface = *static_cast<Subsurface*>(wl_resource_get_user_data(resource));
+        subsurface.m_synchronized = false;
+
+        // Whatever was cached waiting for the parent shows right away.
+        if (subsurface.m_surface && !subsurface.isSynchronized())
+            subsurface.m_surface->applyCachedState();
+    }
+};
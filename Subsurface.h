@@ -0,0 +1,85 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Subsurface_h
+#define Subsurface_h
+
+#include <cstdint>
+#include <wayland-server.h>
+
+class Surface;
+
+// The wl_subsurface role. Each subsurface keeps its own dispmanx element,
+// placed relative to its parent and stacked with it, so that the HVS
+// composites video and other content without any GPU work.
+class Subsurface {
+public:
+    // Creates the wl_subcompositor global.
+    static bool initialize(struct wl_display*);
+
+    struct Position {
+        int32_t x;
+        int32_t y;
+    };
+
+    // Null once the surface or the parent is destroyed.
+    Surface* surface() const { return m_surface; }
+    Surface* parent() const { return m_parent; }
+
+    // Position relative to the parent, applied when the parent commits.
+    const Position& position() const { return m_position.current; }
+    bool applyPosition();
+
+    // Synchronized subsurfaces cache their commits until the parent's state
+    // is applied. A subsurface is synchronized when any ancestor is.
+    bool isSynchronized() const;
+
+    void surfaceDestroyed();
+    void parentDestroyed();
+
+private:
+    Subsurface(Surface&, Surface& parent, struct wl_client*, uint32_t version, uint32_t id);
+    ~Subsurface();
+
+    static void bindSubcompositorInterface(struct wl_client*, void*, uint32_t, uint32_t);
+    static const struct wl_subcompositor_interface m_subcompositorInterface;
+    static const struct wl_subsurface_interface m_subsurfaceInterface;
+
+    static void place(struct wl_resource*, struct wl_resource* siblingResource, bool above);
+
+    struct wl_resource* m_resource;
+    Surface* m_surface;
+    Surface* m_parent;
+    bool m_synchronized;
+
+    struct {
+        Position current;
+        Position pending;
+    } m_position;
+};
+
+#endif // Subsurface_h
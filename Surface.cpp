@@ -27,98 +27,438 @@
 
 #include "Surface.h"
 
-#include "Athol.h"
+#include "Cursor.h"
+#include "Subsurface.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <utility>
 #include <vector>
 
-#define BUILD_WAYLAND
-#include <bcm_host.h>
-
 struct FrameCallback {
     struct wl_resource* resource;
     struct wl_list link;
+    uint64_t update;
+};
+
+struct RetiredBuffer {
+    struct wl_resource* resource;
+    struct wl_listener destroyListener;
+    struct wl_list link;
+    uint64_t update;
 };
 
-Surface::Surface(Athol& athol, struct wl_client* client, struct wl_resource* resource, uint32_t id)
-    : m_athol(athol)
-    , m_background(DISPMANX_NO_HANDLE)
+static void initializeCallbacks(Surface::Callbacks& callbacks)
+{
+    wl_list_init(&callbacks.pending);
+    wl_list_init(&callbacks.cached);
+    wl_list_init(&callbacks.committed);
+    wl_list_init(&callbacks.submitted);
+    wl_list_init(&callbacks.throttled);
+}
+
+static void destroyFrameCallbacks(struct wl_list* list)
+{
+    FrameCallback* callback;
+    FrameCallback* nextCallback;
+    wl_list_for_each_safe(callback, nextCallback, list, link)
+        wl_resource_destroy(callback->resource);
+}
+
+Surface::Surface(Output& output, struct wl_client* client, struct wl_resource* resource, uint32_t id)
+    : m_output(&output)
+    , m_hasCachedState(false)
+    , m_subsurface(nullptr)
+    , m_cursor(nullptr)
+    , m_elementHandle(Backend::NoHandle)
+    , m_showsBackground(true)
+    , m_x(0)
+    , m_y(0)
+    , m_width(0)
+    , m_height(0)
+    , m_opaque(true)
+    , m_occluded(false)
+    , m_scaleX(1)
+    , m_scaleY(1)
+    , m_priority(API::SurfacePriority::Normal)
 {
     m_resource = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(resource), id);
     wl_resource_set_implementation(m_resource, &m_surfaceInterface, this, destroySurface);
 
-    wl_list_init(&m_frameCallbacks);
+    statistics.client = 0;
+    wl_client_get_credentials(client, &statistics.client, nullptr, nullptr);
+    statistics.id = id;
+    statistics.created = FrameClock::now();
+    statistics.commits = 0;
+    statistics.pendingCommit = 0;
 
-    {
-        Athol::Update update(athol);
+    initializeCallbacks(m_frameCallbacks);
+    initializeCallbacks(m_feedbacks);
+    wl_list_init(&link);
+    wl_list_init(&frameLink);
+    wl_list_init(&throttleLink);
+    wl_list_init(&m_retiredBuffers);
 
-        uint32_t imagePtr;
-        VC_RECT_T rect;
-        vc_dispmanx_rect_set(&rect, 0, 0, athol.width(), athol.height());
-        std::vector<uint8_t> pixels(athol.width() * athol.height() * 4, 0);
-        m_background = vc_dispmanx_resource_create(VC_IMAGE_ARGB8888, athol.width(), athol.height(), &imagePtr);
-        vc_dispmanx_resource_write_data(m_background, VC_IMAGE_ARGB8888, athol.width() * 4, pixels.data(), &rect);
+    m_buffers.committedAttached = false;
+    m_buffers.cachedAttached = false;
+    m_buffers.pendingAttached = false;
 
-        m_elementHandle = createElement(update, m_background);
-    }
+    m_opaqueRegionSet.current = false;
+    m_opaqueRegionSet.cached = false;
+    m_opaqueRegionSet.pending = false;
+
+    m_inputRegion.current = Region::infinite();
+    m_inputRegion.cached = m_inputRegion.current;
+    m_inputRegion.pending = m_inputRegion.current;
+
+    m_stack.current.push_back(this);
+    m_stack.pending.push_back(this);
+
+    m_layer = m_output->addSurface(*this);
+    m_output->enterSurface(m_resource);
+
+    m_elementHandle = createElement(m_output->frameUpdate());
 }
 
 Surface::~Surface()
 {
-    FrameCallback* callback;
-    FrameCallback* nextCallback;
-    wl_list_for_each_safe(callback, nextCallback, &m_frameCallbacks, link)
-        wl_resource_destroy(callback->resource);
+    destroyFrameCallbacks(&m_frameCallbacks.pending);
+    destroyFrameCallbacks(&m_frameCallbacks.cached);
+    destroyFrameCallbacks(&m_frameCallbacks.committed);
+    destroyFrameCallbacks(&m_frameCallbacks.submitted);
+    destroyFrameCallbacks(&m_frameCallbacks.throttled);
+
+    Presentation::discard(&m_feedbacks.pending);
+    Presentation::discard(&m_feedbacks.cached);
+    Presentation::discard(&m_feedbacks.committed);
+    Presentation::discard(&m_feedbacks.submitted);
 
-    wl_list_init(&m_frameCallbacks);
+    // The elements go away with the next update, which is close enough.
+    releaseRetiredBuffers(UINT64_MAX);
+
+    if (m_subsurface)
+        m_subsurface->surfaceDestroyed();
+
+    std::vector<Surface*> stack = m_stack.pending;
+    for (Surface* surface : stack) {
+        if (surface != this)
+            surface->m_subsurface->parentDestroyed();
+    }
+
+    // Cursor surfaces left the stack already.
+    if (m_cursor)
+        m_cursor->surfaceDestroyed(*this);
+    else
+        m_output->removeSurface(*this);
+
+    if (m_elementHandle != Backend::NoHandle) {
+        Output::Update& update = m_output->frameUpdate();
+        update.backend().removeElement(update.handle(), m_elementHandle);
+    }
+}
 
-    if (m_background == DISPMANX_NO_HANDLE && m_elementHandle == DISPMANX_NO_HANDLE)
+Surface* Surface::fromResource(struct wl_resource* resource)
+{
+    return static_cast<Surface*>(wl_resource_get_user_data(resource));
+}
+
+void Surface::setOutput(Output& output)
+{
+    if (&output == m_output)
         return;
 
-    {
-        Athol::Update update(m_athol);
-        if (m_background != DISPMANX_NO_HANDLE)
-            vc_dispmanx_resource_delete(m_background);
-        if (m_elementHandle != DISPMANX_NO_HANDLE)
-            vc_dispmanx_element_remove(update.handle(), m_elementHandle);
+    if (m_elementHandle != Backend::NoHandle) {
+        Output::Update& update = m_output->frameUpdate();
+        update.backend().removeElement(update.handle(), m_elementHandle);
+        m_elementHandle = Backend::NoHandle;
+    }
+
+    // Update serials are counted per output, so nothing submitted to the old
+    // one can wait for the new one. Frame callbacks complete now, and the
+    // retired buffers go with them, which is close enough as the element is
+    // removed with the next update.
+    Presentation::discard(&m_feedbacks.submitted);
+    Presentation::Timing timing = { FrameClock::now(), 0, 0, 0, nullptr };
+    dispatchFrameCallbacks(UINT64_MAX, timing);
+    dispatchThrottledFrameCallbacks(timing.time);
+
+    m_output->leaveSurface(m_resource);
+    m_output->removeSurface(*this);
+
+    m_output = &output;
+    m_occluded = false;
+    m_layer = m_output->addSurface(*this);
+    m_output->enterSurface(m_resource);
+
+    if (m_showsBackground)
+        m_elementHandle = createElement(m_output->frameUpdate());
+    else if (m_buffers.current)
+        m_damage.current.assign(1, { 0, 0, m_width, m_height });
+    m_output->scheduleRepaint(*this);
+
+    for (Surface* surface : m_stack.pending) {
+        if (surface != this)
+            surface->setOutput(output);
+    }
+    m_output->scheduleRestack();
+}
+
+void Surface::repaint(Output::Update& update)
+{
+    ATHOL_TRACE_SCOPE("Surface::repaint");
+    updateContent(update);
+
+    if (isThrottled()) {
+        if (!wl_list_empty(&m_frameCallbacks.committed)) {
+            wl_list_insert_list(m_frameCallbacks.throttled.prev, &m_frameCallbacks.committed);
+            wl_list_init(&m_frameCallbacks.committed);
+            m_output->throttleFrameCallbacks(*this);
+        }
+    } else {
+        FrameCallback* callback;
+        wl_list_for_each(callback, &m_frameCallbacks.committed, link)
+            callback->update = update.serial();
+        wl_list_insert_list(m_frameCallbacks.submitted.prev, &m_frameCallbacks.committed);
+        wl_list_init(&m_frameCallbacks.committed);
+    }
+
+    // Commits that do not make it to the screen are discarded.
+    if (m_occluded || m_showsBackground || !m_buffers.current) {
+        Presentation::discard(&m_feedbacks.committed);
+        return;
     }
+
+    Presentation::Feedback* feedback;
+    wl_list_for_each(feedback, &m_feedbacks.committed, link)
+        feedback->update = update.serial();
+    wl_list_insert_list(m_feedbacks.submitted.prev, &m_feedbacks.committed);
+    wl_list_init(&m_feedbacks.committed);
 }
 
-void Surface::repaint(Athol::Update& update)
+void Surface::updateContent(Output::Update& update)
 {
-    std::swap(m_buffers.current, m_buffers.pending);
+    if (m_buffers.committedAttached) {
+        m_buffers.committedAttached = false;
+        if (m_buffers.current && m_buffers.current.resource() != m_buffers.committed.resource())
+            retireBuffer(m_buffers.current, update.serial());
+        m_buffers.current = std::move(m_buffers.committed);
+
+        // A null buffer unmaps the surface, until the next one is attached.
+        if (!m_buffers.current) {
+            if (m_elementHandle != Backend::NoHandle)
+                update.backend().removeElement(update.handle(), m_elementHandle);
+            m_elementHandle = Backend::NoHandle;
+            m_showsBackground = false;
+            m_width = 0;
+            m_height = 0;
+            m_damage.current.clear();
+            return;
+        }
+    } else if (m_damage.current.empty())
+        return;
+
     if (!m_buffers.current)
         return;
 
-    EGLint width, height;
-    Athol::f_queryWaylandBuffer(update.eglDisplay(), m_buffers.current.resource(), EGL_WIDTH, &width);
-    Athol::f_queryWaylandBuffer(update.eglDisplay(), m_buffers.current.resource(), EGL_HEIGHT, &height);
+    const Backend::BufferInfo* info = update.backend().bufferInfo(m_buffers.current.resource());
+    if (!info)
+        return;
+    int32_t width = info->width;
+    int32_t height = info->height;
+
+    bool resized = width != m_width || height != m_height;
+    m_width = width;
+    m_height = height;
+
+    // Subsurfaces follow the scale of the top-level surface.
+    if (resized && !parent() && hasSubsurfaces())
+        m_output->scheduleRestack();
+
+    // Blending can only be switched when the element is created.
+    bool opaque = isOpaque();
+    if (m_showsBackground || opaque != m_opaque) {
+        m_showsBackground = false;
+        m_opaque = opaque;
+
+        if (m_elementHandle != Backend::NoHandle)
+            update.backend().removeElement(update.handle(), m_elementHandle);
+        m_elementHandle = Backend::NoHandle;
+    }
+
+    // Occluded surfaces pick up their content when they are shown again.
+    if (m_occluded) {
+        m_damage.current.clear();
+        return;
+    }
+
+    if (m_elementHandle == Backend::NoHandle)
+        m_elementHandle = createElement(update);
+    else if (resized)
+        update.backend().changeElementAttributes(update.handle(), m_elementHandle, m_layer, m_width, m_height, extent());
+
+    update.backend().changeElementSource(update.handle(), m_elementHandle, m_buffers.current.resource(), m_damage.current);
+    m_damage.current.clear();
+}
+
+Backend::Rect Surface::extent() const
+{
+    if (!m_showsBackground && !m_buffers.current)
+        return { m_x, m_y, 0, 0 };
+
+    // Top-level surfaces are scaled to the screen whatever their size.
+    if (!parent())
+        return { 0, 0, int32_t(m_output->width()), int32_t(m_output->height()) };
+    return { m_x, m_y, int32_t(std::lround(m_width * m_scaleX)), int32_t(std::lround(m_height * m_scaleY)) };
+}
+
+Region Surface::opaqueRegion() const
+{
+    if (m_opaque)
+        return Region(extent());
+
+    Backend::Rect extent = this->extent();
+    if (extent.width == m_width && extent.height == m_height) {
+        Region region = m_opaqueRegion.current;
+        region.translate(m_x, m_y);
+        region.intersect(extent);
+        return region;
+    }
+
+    // Scaled down to the pixels that are opaque for sure, as the edges get
+    // filtered with their transparent neighbours.
+    Region region;
+    if (!m_width || !m_height)
+        return region;
+    m_opaqueRegion.current.forEachRect([this, &extent, &region](const Region::Rect& rect) {
+        int64_t left = std::max<int64_t>(rect.x, 0);
+        int64_t top = std::max<int64_t>(rect.y, 0);
+        int64_t right = std::min<int64_t>(int64_t(rect.x) + rect.width, m_width);
+        int64_t bottom = std::min<int64_t>(int64_t(rect.y) + rect.height, m_height);
+        if (left >= right || top >= bottom)
+            return;
 
-    if (width != update.width() || height != update.height())
+        int64_t x1 = (left * extent.width + m_width - 1) / m_width + 1;
+        int64_t y1 = (top * extent.height + m_height - 1) / m_height + 1;
+        int64_t x2 = right * extent.width / m_width - 1;
+        int64_t y2 = bottom * extent.height / m_height - 1;
+        if (x1 < x2 && y1 < y2)
+            region.unite({ extent.x + int32_t(x1), extent.y + int32_t(y1), int32_t(x2 - x1), int32_t(y2 - y1) });
+    });
+    return region;
+}
+
+void Surface::setOccluded(Output::Update& update, bool occluded)
+{
+    if (occluded == m_occluded)
         return;
+    m_occluded = occluded;
+
+    if (!isThrottled())
+        m_output->unthrottleFrameCallbacks(*this);
 
-    if (m_background != DISPMANX_NO_HANDLE) {
-        vc_dispmanx_resource_delete(m_background);
-        m_background = DISPMANX_NO_HANDLE;
+    if (occluded) {
+        if (m_elementHandle != Backend::NoHandle)
+            update.backend().removeElement(update.handle(), m_elementHandle);
+        m_elementHandle = Backend::NoHandle;
+        return;
+    }
 
-        if (m_elementHandle != DISPMANX_NO_HANDLE)
-            vc_dispmanx_element_remove(update.handle(), m_elementHandle);
-        m_elementHandle = createElement(update, DISPMANX_NO_HANDLE);
+    if (m_showsBackground) {
+        m_elementHandle = createElement(update);
+        return;
     }
 
-    vc_dispmanx_element_change_source(update.handle(), m_elementHandle,
-        vc_dispmanx_get_handle_from_wl_buffer(m_buffers.current.resource()));
+    if (!m_buffers.current)
+        return;
+
+    std::vector<Backend::Rect> damage(1, { 0, 0, m_width, m_height });
+    m_elementHandle = createElement(update);
+    update.backend().changeElementSource(update.handle(), m_elementHandle, m_buffers.current.resource(), damage);
 }
 
-void Surface::dispatchFrameCallbacks(uint64_t time)
+bool Surface::acceptsInput(int32_t x, int32_t y) const
+{
+    if (!m_buffers.current || x < 0 || y < 0 || x >= m_width || y >= m_height)
+        return false;
+    return m_inputRegion.current.contains(x, y);
+}
+
+void Surface::toSurfaceCoordinates(double x, double y, double& surfaceX, double& surfaceY) const
+{
+    Backend::Rect extent = this->extent();
+    surfaceX = x - extent.x;
+    surfaceY = y - extent.y;
+    if (extent.width > 0 && extent.height > 0) {
+        surfaceX = surfaceX * m_width / extent.width;
+        surfaceY = surfaceY * m_height / extent.height;
+    }
+}
+
+bool Surface::isOpaque() const
+{
+    if (struct wl_shm_buffer* shmBuffer = wl_shm_buffer_get(m_buffers.current.resource())) {
+        if (wl_shm_buffer_get_format(shmBuffer) == WL_SHM_FORMAT_XRGB8888
+            || wl_shm_buffer_get_format(shmBuffer) == WL_SHM_FORMAT_RGB565)
+            return true;
+    } else if (!m_opaqueRegionSet.current)
+        return true;
+
+    return m_opaqueRegion.current.contains({ 0, 0, m_width, m_height });
+}
+
+bool Surface::dispatchFrameCallbacks(uint64_t completedUpdate, const Presentation::Timing& timing)
+{
+    FrameCallback* callback;
+    FrameCallback* nextCallback;
+    wl_list_for_each_safe(callback, nextCallback, &m_frameCallbacks.submitted, link) {
+        if (callback->update > completedUpdate)
+            continue;
+
+        wl_callback_send_done(callback->resource, timing.time / 1000000);
+        wl_resource_destroy(callback->resource);
+    }
+
+    Presentation::present(&m_feedbacks.submitted, completedUpdate, timing);
+    releaseRetiredBuffers(completedUpdate);
+
+    return !wl_list_empty(&m_frameCallbacks.submitted) || !wl_list_empty(&m_feedbacks.submitted)
+        || !wl_list_empty(&m_retiredBuffers);
+}
+
+bool Surface::isThrottled() const
+{
+    switch (m_priority) {
+    case API::SurfacePriority::Foreground:
+        return false;
+    case API::SurfacePriority::Background:
+        return true;
+    case API::SurfacePriority::Normal:
+        break;
+    }
+    return m_occluded;
+}
+
+void Surface::setPriority(API::SurfacePriority priority)
+{
+    m_priority = priority;
+    if (!isThrottled())
+        m_output->unthrottleFrameCallbacks(*this);
+}
+
+void Surface::dispatchThrottledFrameCallbacks(uint64_t time)
 {
     FrameCallback* callback;
     FrameCallback* nextCallback;
-    wl_list_for_each_safe(callback, nextCallback, &m_frameCallbacks, link) {
-        wl_callback_send_done(callback->resource, time);
+    wl_list_for_each_safe(callback, nextCallback, &m_frameCallbacks.throttled, link) {
+        wl_callback_send_done(callback->resource, time / 1000000);
         wl_resource_destroy(callback->resource);
     }
+}
 
-    wl_list_init(&m_frameCallbacks);
+void Surface::addPresentationFeedback(Presentation::Feedback& feedback)
+{
+    wl_list_insert(m_feedbacks.pending.prev, &feedback.link);
 }
 
 void Surface::destroySurface(struct wl_resource* resource)
@@ -138,17 +478,15 @@ const struct wl_surface_interface Surface::m_surfaceInterface {
     [](struct wl_client*, struct wl_resource* resource, struct wl_resource* bufferResource, int32_t, int32_t)
     {
         auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(resource));
-
-        if (surface.m_buffers.pending.resource() != bufferResource) {
-            struct wl_resource* previousBufferResource = surface.m_buffers.pending.resource();
-            surface.m_buffers.pending = Buffer(bufferResource);
-
-            if (previousBufferResource)
-                wl_resource_queue_event(previousBufferResource, WL_BUFFER_RELEASE);
-        }
+        surface.m_buffers.pending = Buffer(bufferResource);
+        surface.m_buffers.pendingAttached = true;
     },
     // damage
-    [](struct wl_client*, struct wl_resource*, int32_t, int32_t, int32_t, int32_t) { },
+    [](struct wl_client*, struct wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
+    {
+        auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(resource));
+        surface.m_damage.pending.push_back({ x, y, width, height });
+    },
     // frame
     [](struct wl_client* client, struct wl_resource* resource, uint32_t callbackID)
     {
@@ -162,36 +500,379 @@ const struct wl_surface_interface Surface::m_surfaceInterface {
             });
 
         auto* surface = static_cast<Surface*>(wl_resource_get_user_data(resource));
-        wl_list_insert(surface->m_frameCallbacks.prev, &callback->link);
+        callback->update = 0;
+        wl_list_insert(surface->m_frameCallbacks.pending.prev, &callback->link);
     },
     // set_opaque_region
-    [](struct wl_client*, struct wl_resource*, struct wl_resource*) { },
+    [](struct wl_client*, struct wl_resource* resource, struct wl_resource* regionResource)
+    {
+        auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(resource));
+        const Region* region = Region::fromResource(regionResource);
+        surface.m_opaqueRegion.pending = region ? *region : Region();
+        surface.m_opaqueRegionSet.pending = true;
+    },
     // set_input_region
-    [](struct wl_client*, struct wl_resource*, struct wl_resource*) { },
+    [](struct wl_client*, struct wl_resource* resource, struct wl_resource* regionResource)
+    {
+        auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(resource));
+        const Region* region = Region::fromResource(regionResource);
+        surface.m_inputRegion.pending = region ? *region : Region::infinite();
+    },
     // commit
     [](struct wl_client*, struct wl_resource* resource)
     {
+        ATHOL_TRACE_SCOPE("Surface::commit");
         auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(resource));
-        surface.m_athol.scheduleRepaint(surface);
+        surface.commit();
     },
     // set_buffer_transform
     [](struct wl_client*, struct wl_resource*, int) { },
     // set_buffer_scale
-    [](struct wl_client*, struct wl_resource*, int32_t) { }
+    [](struct wl_client*, struct wl_resource*, int32_t) { },
+    // damage_buffer
+    [](struct wl_client*, struct wl_resource* resource, int32_t x, int32_t y, int32_t width, int32_t height)
+    {
+        auto& surface = *static_cast<Surface*>(wl_resource_get_user_data(resource));
+        surface.m_damage.pending.push_back({ x, y, width, height });
+    }
 };
 
-DISPMANX_ELEMENT_HANDLE_T Surface::createElement(Athol::Update& update, DISPMANX_RESOURCE_HANDLE_T resource)
+Backend::ElementHandle Surface::createElement(Output::Update& update)
+{
+    if (m_showsBackground)
+        return update.backend().addElement(update.handle(), m_layer, m_output->backgroundResource(), 1, 1, extent(), m_opaque);
+
+    // The source is attached right after, from the surface's buffer.
+    return update.backend().addElement(update.handle(), m_layer, Backend::NoHandle, m_width, m_height, extent(), m_opaque);
+}
+
+void Surface::setPlacement(Output::Update& update, int32_t layer, int32_t x, int32_t y, double scaleX, double scaleY)
 {
-    static VC_DISPMANX_ALPHA_T alpha = {
-        static_cast<DISPMANX_FLAGS_ALPHA_T>(DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS),
-        255, 0
+    if (layer == m_layer && x == m_x && y == m_y && scaleX == m_scaleX && scaleY == m_scaleY)
+        return;
+
+    m_layer = layer;
+    m_x = x;
+    m_y = y;
+    m_scaleX = scaleX;
+    m_scaleY = scaleY;
+    if (m_elementHandle == Backend::NoHandle)
+        return;
+
+    if (m_showsBackground)
+        update.backend().changeElementAttributes(update.handle(), m_elementHandle, m_layer, 1, 1, extent());
+    else
+        update.backend().changeElementAttributes(update.handle(), m_elementHandle, m_layer, m_width, m_height, extent());
+}
+
+void Surface::restack(Output::Update& update, struct wl_list* stack, int32_t& layer, int32_t x, int32_t y)
+{
+    double scaleX, scaleY;
+    screenScale(scaleX, scaleY);
+
+    for (Surface* surface : m_stack.current) {
+        if (surface == this) {
+            wl_list_insert(stack->prev, &stackLink);
+            setPlacement(update, layer++, x, y, scaleX, scaleY);
+            continue;
+        }
+
+        const Subsurface::Position& position = surface->m_subsurface->position();
+        surface->restack(update, stack, layer,
+            x + int32_t(std::lround(position.x * scaleX)), y + int32_t(std::lround(position.y * scaleY)));
+    }
+}
+
+void Surface::screenScale(double& scaleX, double& scaleY) const
+{
+    const Surface* root = this;
+    while (Surface* parent = root->parent())
+        root = parent;
+
+    scaleX = 1;
+    scaleY = 1;
+    if (root->m_width > 0 && root->m_height > 0) {
+        scaleX = double(m_output->width()) / root->m_width;
+        scaleY = double(m_output->height()) / root->m_height;
+    }
+}
+
+void Surface::releaseBuffer(Buffer& buffer)
+{
+    if (buffer)
+        wl_resource_queue_event(buffer.resource(), WL_BUFFER_RELEASE);
+    buffer = Buffer();
+}
+
+void Surface::retireBuffer(Buffer& buffer, uint64_t update)
+{
+    // The contents of shm buffers were copied at upload.
+    if (wl_shm_buffer_get(buffer.resource())) {
+        releaseBuffer(buffer);
+        return;
+    }
+
+    auto* retiredBuffer = new RetiredBuffer;
+    retiredBuffer->resource = buffer.resource();
+    retiredBuffer->update = update;
+    retiredBuffer->destroyListener.notify = [](struct wl_listener* listener, void*)
+    {
+        RetiredBuffer* retiredBuffer = wl_container_of(listener, retiredBuffer, destroyListener);
+        wl_list_remove(&retiredBuffer->link);
+        delete retiredBuffer;
     };
+    wl_resource_add_destroy_listener(retiredBuffer->resource, &retiredBuffer->destroyListener);
+    wl_list_insert(m_retiredBuffers.prev, &retiredBuffer->link);
+
+    buffer = Buffer();
+}
+
+void Surface::releaseRetiredBuffers(uint64_t completedUpdate)
+{
+    RetiredBuffer* retiredBuffer;
+    RetiredBuffer* nextRetiredBuffer;
+    wl_list_for_each_safe(retiredBuffer, nextRetiredBuffer, &m_retiredBuffers, link) {
+        if (retiredBuffer->update > completedUpdate)
+            continue;
+
+        wl_list_remove(&retiredBuffer->destroyListener.link);
+        wl_list_remove(&retiredBuffer->link);
+        wl_resource_queue_event(retiredBuffer->resource, WL_BUFFER_RELEASE);
+        delete retiredBuffer;
+    }
+}
+
+void Surface::commit()
+{
+    // Everything goes through the cached state, which synchronized
+    // subsurfaces keep until their parent commits.
+    cacheState();
+    if (!isSynchronized())
+        applyCachedState();
+}
+
+static void appendDamage(std::vector<Backend::Rect>& damage, std::vector<Backend::Rect>& added, size_t maxDamageRects)
+{
+    damage.insert(damage.end(), added.begin(), added.end());
+    added.clear();
+
+    // Too fragmented to be worth tracking, or piling up without repaints.
+    if (damage.size() > maxDamageRects)
+        damage.assign(1, { 0, 0, INT32_MAX, INT32_MAX });
+}
+
+void Surface::cacheState()
+{
+    if (m_buffers.pendingAttached) {
+        if (m_buffers.cached && m_buffers.cached.resource() != m_buffers.pending.resource())
+            releaseBuffer(m_buffers.cached);
+        m_buffers.cached = std::move(m_buffers.pending);
+        m_buffers.cachedAttached = true;
+        m_buffers.pendingAttached = false;
+    }
+
+    appendDamage(m_damage.cached, m_damage.pending, s_maxDamageRects);
+    m_opaqueRegion.cached = m_opaqueRegion.pending;
+    m_opaqueRegionSet.cached = m_opaqueRegionSet.pending;
+    m_inputRegion.cached = m_inputRegion.pending;
+
+    wl_list_insert_list(m_frameCallbacks.cached.prev, &m_frameCallbacks.pending);
+    wl_list_init(&m_frameCallbacks.pending);
+
+    // A commit replaced before it was shown is never presented.
+    Presentation::discard(&m_feedbacks.cached);
+    wl_list_insert_list(m_feedbacks.cached.prev, &m_feedbacks.pending);
+    wl_list_init(&m_feedbacks.pending);
+
+    m_hasCachedState = true;
+}
+
+void Surface::applyCachedState()
+{
+    if (!m_hasCachedState)
+        return;
+    m_hasCachedState = false;
+
+    if (m_cursor) {
+        applyCursorState();
+        return;
+    }
+
+    if (m_buffers.cachedAttached) {
+        if (m_buffers.committed && m_buffers.committed.resource() != m_buffers.cached.resource())
+            releaseBuffer(m_buffers.committed);
+        m_buffers.committed = std::move(m_buffers.cached);
+        m_buffers.committedAttached = true;
+        m_buffers.cachedAttached = false;
+    }
+
+    appendDamage(m_damage.current, m_damage.cached, s_maxDamageRects);
+    m_opaqueRegion.current = m_opaqueRegion.cached;
+    m_opaqueRegionSet.current = m_opaqueRegionSet.cached;
+    m_inputRegion.current = m_inputRegion.cached;
+
+    wl_list_insert_list(m_frameCallbacks.committed.prev, &m_frameCallbacks.cached);
+    wl_list_init(&m_frameCallbacks.cached);
+
+    Presentation::discard(&m_feedbacks.committed);
+    wl_list_insert_list(m_feedbacks.committed.prev, &m_feedbacks.cached);
+    wl_list_init(&m_feedbacks.cached);
+
+    // The order and positions of subsurfaces are part of the parent's state.
+    bool restack = m_stack.current != m_stack.pending;
+    m_stack.current = m_stack.pending;
+    for (Surface* surface : m_stack.current) {
+        if (surface != this && surface->m_subsurface->applyPosition())
+            restack = true;
+    }
+    if (restack)
+        m_output->scheduleRestack();
+
+    m_output->scheduleRepaint(*this);
+
+    // Synchronized subsurfaces show what they cached along with this commit.
+    for (Surface* surface : m_stack.current) {
+        if (surface != this && surface->isSynchronized())
+            surface->applyCachedState();
+    }
+}
+
+void Surface::setCursor(Cursor& cursor)
+{
+    m_cursor = &cursor;
+
+    // Nothing the surface submitted is shown any more, so it is all done.
+    if (m_elementHandle != Backend::NoHandle) {
+        Output::Update& update = m_output->frameUpdate();
+        update.backend().removeElement(update.handle(), m_elementHandle);
+        m_elementHandle = Backend::NoHandle;
+    }
+    m_showsBackground = false;
+    m_occluded = false;
+
+    Presentation::discard(&m_feedbacks.submitted);
+    Presentation::Timing timing = { FrameClock::now(), 0, 0, 0, nullptr };
+    dispatchFrameCallbacks(UINT64_MAX, timing);
+    dispatchThrottledFrameCallbacks(timing.time);
+
+    m_output->removeSurface(*this);
+
+    // Along with a commit that has not been repainted yet.
+    applyCursorState();
+}
+
+void Surface::applyCursorState()
+{
+    // The buffer is kept until it is replaced, for the cursor to copy again
+    // whenever the surface is set as the cursor.
+    if (m_buffers.committedAttached) {
+        m_buffers.committedAttached = false;
+        if (m_buffers.current && m_buffers.current.resource() != m_buffers.committed.resource())
+            releaseBuffer(m_buffers.current);
+        m_buffers.current = std::move(m_buffers.committed);
+    }
+    m_damage.current.clear();
+    m_cursor->surfaceCommitted(*this);
+
+    // The cursor shows the commit right away.
+    Presentation::discard(&m_feedbacks.committed);
+    wl_list_insert_list(m_frameCallbacks.submitted.prev, &m_frameCallbacks.committed);
+    wl_list_init(&m_frameCallbacks.committed);
+    Presentation::Timing timing = { FrameClock::now(), 0, 0, 0, nullptr };
+    dispatchFrameCallbacks(UINT64_MAX, timing);
+}
+
+Surface* Surface::parent() const
+{
+    return m_subsurface ? m_subsurface->parent() : nullptr;
+}
+
+bool Surface::isSynchronized() const
+{
+    return m_subsurface && m_subsurface->isSynchronized();
+}
+
+void Surface::setSubsurface(Subsurface* subsurface)
+{
+    m_subsurface = subsurface;
+    m_output->scheduleRestack();
+
+    if (!subsurface) {
+        unmap();
+        return;
+    }
+
+    // Subsurfaces show nothing until their first buffer.
+    if (m_showsBackground) {
+        m_showsBackground = false;
+        if (m_elementHandle != Backend::NoHandle) {
+            Output::Update& update = m_output->frameUpdate();
+            update.backend().removeElement(update.handle(), m_elementHandle);
+            m_elementHandle = Backend::NoHandle;
+        }
+    }
+}
+
+void Surface::addSubsurface(Surface& surface)
+{
+    m_stack.current.push_back(&surface);
+    m_stack.pending.push_back(&surface);
+}
+
+void Surface::removeSubsurface(Surface& surface)
+{
+    for (auto* stack : { &m_stack.current, &m_stack.pending })
+        stack->erase(std::remove(stack->begin(), stack->end(), &surface), stack->end());
+    m_output->scheduleRestack();
+}
+
+bool Surface::placeSubsurface(Surface& surface, Surface& sibling, bool above)
+{
+    auto& stack = m_stack.pending;
+    if (&surface == &sibling || std::find(stack.begin(), stack.end(), &sibling) == stack.end())
+        return false;
+
+    stack.erase(std::find(stack.begin(), stack.end(), &surface));
+    auto position = std::find(stack.begin(), stack.end(), &sibling);
+    stack.insert(above ? position + 1 : position, &surface);
+    return true;
+}
+
+void Surface::unmap()
+{
+    if (m_elementHandle != Backend::NoHandle) {
+        Output::Update& update = m_output->frameUpdate();
+        update.backend().removeElement(update.handle(), m_elementHandle);
+        m_elementHandle = Backend::NoHandle;
+    }
+    m_showsBackground = false;
+
+    // The client may go on drawing, and wait for these buffers. Those it
+    // already destroyed were forgotten on the way. A buffer held twice is
+    // released once.
+    struct wl_resource* current = m_buffers.current.resource();
+    if (m_buffers.cached.resource() != m_buffers.committed.resource() && m_buffers.cached.resource() != current)
+        releaseBuffer(m_buffers.cached);
+    m_buffers.cached = Buffer();
+    if (m_buffers.committed.resource() != current)
+        releaseBuffer(m_buffers.committed);
+    m_buffers.committed = Buffer();
+    if (m_buffers.current)
+        retireBuffer(m_buffers.current, m_output->frameUpdate().serial());
+    m_buffers.committedAttached = false;
+    m_buffers.cachedAttached = false;
+    m_width = 0;
+    m_height = 0;
 
-    VC_RECT_T srcRect, destRect;
-    vc_dispmanx_rect_set(&srcRect, 0, 0, update.height() << 16, update.width() << 16);
-    vc_dispmanx_rect_set(&destRect, 0, 0, update.height(), update.width());
+    m_damage.current.clear();
+    m_damage.cached.clear();
+    m_hasCachedState = false;
 
-    return vc_dispmanx_element_add(update.handle(), update.displayHandle(), 0,
-        &destRect, resource, &srcRect, DISPMANX_PROTECTION_NONE, &alpha,
-        nullptr, DISPMANX_ROTATE_90);
+    // Frame callbacks still complete, so that the client keeps drawing.
+    wl_list_insert_list(m_frameCallbacks.committed.prev, &m_frameCallbacks.cached);
+    wl_list_init(&m_frameCallbacks.cached);
+    Presentation::discard(&m_feedbacks.cached);
+    Presentation::discard(&m_feedbacks.committed);
+    if (!wl_list_empty(&m_frameCallbacks.committed))
+        m_output->scheduleRepaint(*this);
 }
@@ -28,70 +28,290 @@
 #ifndef Surface_h
 #define Surface_h
 
+#include <API/Interfaces.h>
+#include <sys/types.h>
+#include <vector>
 #include <wayland-server.h>
 
-#define BUILD_WAYLAND
-#include <bcm_host.h>
+#include "Backend.h"
+#include "Output.h"
+#include "Presentation.h"
+#include "Region.h"
 
-#include "Athol.h"
+class Cursor;
+class Subsurface;
 
 class Surface {
 public:
-    Surface(Athol& athol, struct wl_client*, struct wl_resource*, uint32_t);
+    Surface(Output&, struct wl_client*, struct wl_resource*, uint32_t);
     ~Surface();
 
-    void repaint(Athol::Update&);
-    void dispatchFrameCallbacks(uint64_t time);
+    static Surface* fromResource(struct wl_resource*);
+    struct wl_resource* resource() const { return m_resource; }
+
+    // Moves the surface and its subsurfaces to another display. Whatever
+    // was in flight on the old one completes right away.
+    Output& output() const { return *m_output; }
+    void setOutput(Output&);
+
+    void repaint(Output::Update&);
+
+    // Completes the frame callbacks and presentation feedback submitted with
+    // updates up to the given one, and releases the buffers those updates
+    // took off the screen. Returns whether any are still in flight.
+    bool dispatchFrameCallbacks(uint64_t completedUpdate, const Presentation::Timing&);
+
+    void addPresentationFeedback(Presentation::Feedback&);
+
+    // Throttled surfaces hold back their frame callbacks until the output
+    // dispatches them at its reduced rate, or the surface is shown again.
+    bool isThrottled() const;
+    void setPriority(API::SurfacePriority);
+    void dispatchThrottledFrameCallbacks(uint64_t time);
+
+    // The area of the screen the surface shows, and the part of it that is
+    // opaque, both in screen coordinates.
+    Backend::Rect extent() const;
+    Region opaqueRegion() const;
+    void setOccluded(Output::Update&, bool);
+
+    // Whether the point, in surface coordinates, is on the buffer and in the
+    // input region. In O(log n) of the rectangles in the region.
+    bool acceptsInput(int32_t x, int32_t y) const;
+
+    // Maps a point on the screen to the surface, undoing the scaling of
+    // top-level surfaces, which their subsurfaces share.
+    void toSurfaceCoordinates(double x, double y, double& surfaceX, double& surfaceY) const;
+
+    // The subsurface role, if the surface has it, and the parent it gives.
+    Subsurface* subsurface() const { return m_subsurface; }
+    Surface* parent() const;
+    bool isSynchronized() const;
+    void setSubsurface(Subsurface*);
+
+    // The cursor role. Cursor surfaces leave the stack, and their buffers
+    // are shown by the cursor's element instead.
+    Cursor* cursor() const { return m_cursor; }
+    void setCursor(Cursor&);
+    struct wl_resource* buffer() const { return m_buffers.current.resource(); }
+
+    // Subsurfaces are stacked with their parent, new ones on top. Changes to
+    // the order apply when the parent commits.
+    void addSubsurface(Surface&);
+    bool hasSubsurfaces() const { return m_stack.current.size() > 1 || m_stack.pending.size() > 1; }
+    void removeSubsurface(Surface&);
+    bool placeSubsurface(Surface&, Surface& sibling, bool above);
+
+    // Applies the state committed while the surface was synchronized.
+    void applyCachedState();
+
+    // Drops the content and the element, until the next buffer shows.
+    void unmap();
+
+    // Appends the surface and its subsurfaces to the stack, bottom to top,
+    // giving them consecutive layers and placing them at (x, y) plus their
+    // position relative to this surface, scaled to the screen along with
+    // the top-level surface.
+    void restack(Output::Update&, struct wl_list* stack, int32_t& layer, int32_t x, int32_t y);
 
     struct wl_list link;
+    struct wl_list stackLink;
+    struct wl_list frameLink;
+    struct wl_list throttleLink;
+
+    // Commit counters read by FrameStatistics. pendingCommit is the time of
+    // the first commit not repainted yet, or 0.
+    struct Statistics {
+        pid_t client;
+        uint32_t id;
+        uint64_t created;
+        uint64_t commits;
+        uint64_t pendingCommit;
+    } statistics;
+
+    // Frame callbacks and presentation feedback go from pending to committed
+    // on commit, through cached while a synchronized subsurface waits for
+    // its parent, and are submitted with the update that shows the commit.
+    // Frame callbacks of throttled surfaces are held back instead.
+    struct Callbacks {
+        struct wl_list pending;
+        struct wl_list cached;
+        struct wl_list committed;
+        struct wl_list submitted;
+        struct wl_list throttled;
+    };
 
 private:
     static void destroySurface(struct wl_resource*);
     static const struct wl_surface_interface m_surfaceInterface;
 
-    Athol& m_athol;
+    Output* m_output;
     struct wl_resource* m_resource;
 
-    struct wl_list m_frameCallbacks;
+    Callbacks m_frameCallbacks;
+    Callbacks m_feedbacks;
 
+    void commit();
+    void cacheState();
+    void updateContent(Output::Update&);
+    void setPlacement(Output::Update&, int32_t layer, int32_t x, int32_t y, double scaleX, double scaleY);
+    void screenScale(double& scaleX, double& scaleY) const;
+
+    // Holds a wl_buffer until it is released, and forgets it if the client
+    // destroys it first.
     class Buffer {
     public:
         Buffer()
             : m_resource(nullptr)
-        { }
+        {
+            wl_list_init(&m_destroyListener.link);
+        }
         Buffer(struct wl_resource* resource)
-            : m_resource(resource)
-        { }
+            : m_resource(nullptr)
+        {
+            wl_list_init(&m_destroyListener.link);
+            setResource(resource);
+        }
+        ~Buffer()
+        {
+            wl_list_remove(&m_destroyListener.link);
+        }
 
         Buffer(Buffer&& o)
-            : m_resource(o.m_resource)
+            : m_resource(nullptr)
         {
-            o.m_resource = nullptr;
+            wl_list_init(&m_destroyListener.link);
+            setResource(o.m_resource);
+            o.setResource(nullptr);
         }
 
         Buffer& operator=(Buffer&& o)
         {
-            m_resource = o.m_resource;
-            o.m_resource = nullptr;
+            if (this != &o) {
+                setResource(o.m_resource);
+                o.setResource(nullptr);
+            }
+            return *this;
         }
 
-        bool operator!() { return !m_resource; }
+        bool operator!() const { return !m_resource; }
+        explicit operator bool() const { return !!m_resource; }
 
-        struct wl_resource* resource() { return m_resource; }
+        struct wl_resource* resource() const { return m_resource; }
 
     private:
+        void setResource(struct wl_resource* resource)
+        {
+            wl_list_remove(&m_destroyListener.link);
+            wl_list_init(&m_destroyListener.link);
+            m_resource = resource;
+            if (!m_resource)
+                return;
+
+            m_destroyListener.notify = [](struct wl_listener* listener, void*)
+            {
+                Buffer* buffer = wl_container_of(listener, buffer, m_destroyListener);
+                wl_list_remove(&buffer->m_destroyListener.link);
+                wl_list_init(&buffer->m_destroyListener.link);
+                buffer->m_resource = nullptr;
+            };
+            wl_resource_add_destroy_listener(m_resource, &m_destroyListener);
+        }
+
         struct wl_resource* m_resource;
+        struct wl_listener m_destroyListener;
     };
 
+    // The buffer on screen, the one committed for the next repaint, the one
+    // cached for the parent's commit, and the one attached since the last
+    // commit. Attaching null is a change too, which unmaps the surface, so
+    // whether anything was attached is tracked along with the buffers.
     struct Buffers {
         Buffer current;
+        Buffer committed;
+        Buffer cached;
         Buffer pending;
+        bool committedAttached;
+        bool cachedAttached;
+        bool pendingAttached;
     } m_buffers;
+    static void releaseBuffer(Buffer&);
+
+    // Buffers taken off the screen, released once the update that replaced
+    // them completes and the HVS no longer reads from them.
+    struct wl_list m_retiredBuffers;
+    void retireBuffer(Buffer&, uint64_t update);
+    void releaseRetiredBuffers(uint64_t completedUpdate);
+
+    // Damage requested since the last commit, damage cached for the parent's
+    // commit, and damage committed since the last repaint. Buffer scale and
+    // transform are not supported, so surface and buffer coordinates are the
+    // same.
+    struct Damage {
+        std::vector<Backend::Rect> current;
+        std::vector<Backend::Rect> cached;
+        std::vector<Backend::Rect> pending;
+    } m_damage;
+    static const size_t s_maxDamageRects = 32;
+
+    // Opaque and input regions, in surface coordinates, committed, cached
+    // for the parent's commit, and set since the last commit. The input
+    // region is infinite until the client sets one.
+    struct Regions {
+        Region current;
+        Region cached;
+        Region pending;
+    };
+    Regions m_opaqueRegion;
+    Regions m_inputRegion;
+
+    // Whether the client set an opaque region at all. Until it does, buffers
+    // other than wl_shm ones are opaque, as all buffers were before alpha
+    // blending, since clients drawing with EGL rarely set one.
+    struct {
+        bool current;
+        bool cached;
+        bool pending;
+    } m_opaqueRegionSet;
+
+    bool m_hasCachedState;
+
+    Subsurface* m_subsurface;
+
+    Cursor* m_cursor;
+    void applyCursorState();
+
+    // This surface and its subsurfaces, bottom to top.
+    struct Stack {
+        std::vector<Surface*> current;
+        std::vector<Surface*> pending;
+    } m_stack;
+
+    Backend::ElementHandle createElement(Output::Update&);
+    bool isOpaque() const;
+
+    Backend::ElementHandle m_elementHandle;
+    int32_t m_layer;
+
+    // Until its first buffer shows, the surface's element shows the
+    // compositor's shared background.
+    bool m_showsBackground;
+
+    // Position and size of the buffer on screen, and whether the element was
+    // created opaque. Occluded surfaces have no element at all.
+    int32_t m_x;
+    int32_t m_y;
+    int32_t m_width;
+    int32_t m_height;
+    bool m_opaque;
+    bool m_occluded;
 
-    DISPMANX_ELEMENT_HANDLE_T createElement(Athol::Update&, DISPMANX_RESOURCE_HANDLE_T);
+    // Screen pixels per surface pixel of the top-level surface, which its
+    // subsurfaces are scaled by, as of the last restack.
+    double m_scaleX;
+    double m_scaleY;
 
-    DISPMANX_ELEMENT_HANDLE_T m_elementHandle;
-    DISPMANX_RESOURCE_HANDLE_T m_background;
+    API::SurfacePriority m_priority;
 };
 
 #endif // Surface_h
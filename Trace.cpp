@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Trace.h"
+
+#if ATHOL_TRACE
+
+#include "FrameClock.h"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Trace {
+
+std::atomic<bool> enabled(false);
+
+namespace {
+
+struct Event {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Written only by its own thread. The flush reads it from the main thread
+// without stopping the writer, and skips the slots the writer may be about
+// to overwrite.
+struct Ring {
+    static const size_t s_capacity = 1 << 14;
+    static const size_t s_margin = 64;
+
+    Ring()
+        : thread(syscall(SYS_gettid))
+        , head(0)
+    { }
+
+    pid_t thread;
+    std::atomic<uint64_t> head;
+    Event events[s_capacity];
+};
+
+std::mutex ringsMutex;
+std::vector<Ring*> rings;
+const char* path;
+
+thread_local Ring* threadRing;
+
+Ring& ring()
+{
+    if (!threadRing) {
+        // Rings are kept until exit so that the events of threads that are
+        // gone still get flushed.
+        threadRing = new Ring;
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        rings.push_back(threadRing);
+    }
+    return *threadRing;
+}
+
+int signalCallback(int, void*)
+{
+    flush();
+    return 0;
+}
+
+} // namespace
+
+bool initialize(struct wl_event_loop* loop)
+{
+    path = getenv("ATHOL_TRACE_FILE");
+    if (!path || !*path)
+        return true;
+
+    if (!wl_event_loop_add_signal(loop, SIGUSR2, signalCallback, nullptr))
+        return false;
+
+    enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+uint64_t Scope::now()
+{
+    return FrameClock::now();
+}
+
+void record(const char* name, uint64_t start, uint64_t end)
+{
+    Ring& ring = Trace::ring();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    ring.events[head % Ring::s_capacity] = { name, start, end };
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void flush()
+{
+    if (!enabled.load(std::memory_order_relaxed))
+        return;
+
+    FILE* file = std::fopen(path, "w");
+    if (!file) {
+        std::fprintf(stderr, "[Athol] Cannot write trace to %s\n", path);
+        return;
+    }
+
+    std::fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    pid_t process = getpid();
+
+    std::lock_guard<std::mutex> lock(ringsMutex);
+    for (Ring* ring : rings) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t available = Ring::s_capacity - Ring::s_margin;
+        uint64_t tail = head > available ? head - available : 0;
+
+        for (uint64_t i = tail; i < head; ++i) {
+            const Event& event = ring->events[i % Ring::s_capacity];
+            std::fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+                first ? "" : ",\n", event.name, event.start / 1000.0, (event.end - event.start) / 1000.0,
+                int(process), int(ring->thread));
+            first = false;
+        }
+    }
+
+    std::fprintf(file, "\n]}\n");
+    std::fclose(file);
+}
+
+} // namespace Trace
+
+#endif // ATHOL_TRACE
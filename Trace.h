@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Trace_h
+#define Trace_h
+
+// Trace points are compiled in with -DATHOL_TRACE=ON, and record only when
+// ATHOL_TRACE_FILE names the file that SIGUSR2 and shutdown flush them to,
+// as Chrome trace event JSON (chrome://tracing, ui.perfetto.dev).
+#if ATHOL_TRACE
+
+#include <atomic>
+#include <cstdint>
+#include <wayland-server.h>
+
+namespace Trace {
+
+extern std::atomic<bool> enabled;
+
+bool initialize(struct wl_event_loop*);
+void flush();
+
+// Records a complete event on the calling thread's ring buffer. The name
+// must be a string literal, only its address is stored.
+void record(const char* name, uint64_t start, uint64_t end);
+
+class Scope {
+public:
+    explicit Scope(const char* name)
+        : m_name(enabled.load(std::memory_order_relaxed) ? name : nullptr)
+        , m_start(m_name ? now() : 0)
+    { }
+
+    ~Scope()
+    {
+        if (m_name)
+            record(m_name, m_start, now());
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+private:
+    static uint64_t now();
+
+    const char* m_name;
+    uint64_t m_start;
+};
+
+} // namespace Trace
+
+#define ATHOL_TRACE_CONCAT_(a, b) a##b
+#define ATHOL_TRACE_CONCAT(a, b) ATHOL_TRACE_CONCAT_(a, b)
+#define ATHOL_TRACE_SCOPE(name) Trace::Scope ATHOL_TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+
+#define ATHOL_TRACE_SCOPE(name) do { } while (0)
+
+#endif // ATHOL_TRACE
+
+#endif // Trace_h
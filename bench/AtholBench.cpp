@@ -0,0 +1,550 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A Wayland client that loads the compositor with surfaces committing
+// wl_shm buffers, and measures how quickly frame callbacks come back and
+// how many frames miss their slot. Run it against a compositor built for
+// the build host, with ATHOL_BACKEND=headless, to compare builds without a
+// VideoCore. Results are written as JSON; durations are in nanoseconds.
+//
+// Patterns:
+//   steady  Every surface commits at --rate.
+//   bursty  Every surface commits --burst buffers back to back at --rate.
+//   resize  Like steady, with the buffer size changing on every commit.
+//   churn   Like steady, while one surface after the other is destroyed
+//           and created again at --churn-rate.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <string>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <wayland-client.h>
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+enum class Pattern {
+    Steady,
+    Bursty,
+    Resize,
+    Churn
+};
+
+struct Options {
+    const char* socket;
+    const char* output;
+    Pattern pattern;
+    unsigned surfaces;
+    double rate;
+    double duration;
+    unsigned burst;
+    double churnRate;
+    int32_t width;
+    int32_t height;
+};
+
+class Bench;
+
+struct Buffer {
+    struct wl_buffer* buffer;
+    void* data;
+    size_t size;
+    int32_t width;
+    int32_t height;
+    bool busy;
+};
+
+// Double buffered, or one buffer per commit of a burst, plus the one on
+// screen.
+static const unsigned s_maxBuffers = 8;
+
+struct BenchSurface {
+    Bench* bench;
+    struct wl_surface* surface;
+    struct wl_callback* frameCallback;
+    uint64_t commitTime;
+    uint64_t nextCommit;
+    unsigned frame;
+    Buffer buffers[s_maxBuffers];
+};
+
+class Bench {
+public:
+    Bench(const Options& options)
+        : m_options(options)
+        , m_display(nullptr)
+        , m_compositor(nullptr)
+        , m_shm(nullptr)
+        , m_commits(0)
+        , m_frames(0)
+        , m_dropped(0)
+        , m_surfacesCreated(0)
+        , m_nextSurface(0)
+        , m_nextChurn(0)
+    { }
+
+    ~Bench();
+
+    bool initialize();
+    void run();
+    bool writeResults(FILE*) const;
+
+private:
+    static const struct wl_registry_listener s_registryListener;
+    static const struct wl_callback_listener s_frameListener;
+    static const struct wl_buffer_listener s_bufferListener;
+
+    std::unique_ptr<BenchSurface> createSurface(uint64_t time);
+    void destroySurface(BenchSurface&);
+    bool createBuffer(Buffer&, int32_t width, int32_t height);
+    void destroyBuffer(Buffer&);
+    void commit(BenchSurface&, uint64_t time);
+    void frameDone(BenchSurface&);
+
+    uint64_t period() const { return m_options.rate > 0 ? uint64_t(1000000000 / m_options.rate) : 0; }
+
+    Options m_options;
+    struct wl_display* m_display;
+    struct wl_compositor* m_compositor;
+    struct wl_shm* m_shm;
+
+    std::vector<std::unique_ptr<BenchSurface>> m_surfaces;
+
+    uint64_t m_startTime;
+    uint64_t m_endTime;
+    uint64_t m_commits;
+    uint64_t m_frames;
+    uint64_t m_dropped;
+    uint64_t m_surfacesCreated;
+    std::vector<uint64_t> m_latencies;
+
+    size_t m_nextSurface;
+    uint64_t m_nextChurn;
+};
+
+Bench::~Bench()
+{
+    for (auto& surface : m_surfaces)
+        destroySurface(*surface);
+    if (m_shm)
+        wl_shm_destroy(m_shm);
+    if (m_compositor)
+        wl_compositor_destroy(m_compositor);
+    if (m_display)
+        wl_display_disconnect(m_display);
+}
+
+const struct wl_registry_listener Bench::s_registryListener = {
+    // global
+    [](void* data, struct wl_registry* registry, uint32_t name, const char* interface, uint32_t)
+    {
+        auto& bench = *static_cast<Bench*>(data);
+        if (!std::strcmp(interface, wl_compositor_interface.name))
+            bench.m_compositor = static_cast<struct wl_compositor*>(wl_registry_bind(registry, name, &wl_compositor_interface, 1));
+        else if (!std::strcmp(interface, wl_shm_interface.name))
+            bench.m_shm = static_cast<struct wl_shm*>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+    },
+    // global_remove
+    [](void*, struct wl_registry*, uint32_t) { }
+};
+
+bool Bench::initialize()
+{
+    m_display = wl_display_connect(m_options.socket);
+    if (!m_display) {
+        std::fprintf(stderr, "athol-bench: cannot connect to %s\n", m_options.socket ? m_options.socket : "$WAYLAND_DISPLAY");
+        return false;
+    }
+
+    struct wl_registry* registry = wl_display_get_registry(m_display);
+    wl_registry_add_listener(registry, &s_registryListener, this);
+    wl_display_roundtrip(m_display);
+    wl_registry_destroy(registry);
+
+    if (!m_compositor || !m_shm) {
+        std::fprintf(stderr, "athol-bench: wl_compositor or wl_shm missing\n");
+        return false;
+    }
+    return true;
+}
+
+bool Bench::createBuffer(Buffer& buffer, int32_t width, int32_t height)
+{
+    const char* runtimeDir = getenv("XDG_RUNTIME_DIR");
+    std::string path = std::string(runtimeDir ? runtimeDir : "/tmp") + "/athol-bench-XXXXXX";
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    unlink(path.c_str());
+
+    int32_t stride = width * 4;
+    size_t size = size_t(stride) * height;
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool* pool = wl_shm_create_pool(m_shm, fd, size);
+    buffer.buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+    wl_shm_pool_destroy(pool);
+    close(fd);
+
+    wl_buffer_add_listener(buffer.buffer, &s_bufferListener, &buffer);
+    buffer.data = data;
+    buffer.size = size;
+    buffer.width = width;
+    buffer.height = height;
+    buffer.busy = false;
+    return true;
+}
+
+void Bench::destroyBuffer(Buffer& buffer)
+{
+    if (!buffer.buffer)
+        return;
+
+    wl_buffer_destroy(buffer.buffer);
+    munmap(buffer.data, buffer.size);
+    buffer.buffer = nullptr;
+}
+
+const struct wl_buffer_listener Bench::s_bufferListener = {
+    // release
+    [](void* data, struct wl_buffer*)
+    {
+        static_cast<Buffer*>(data)->busy = false;
+    }
+};
+
+std::unique_ptr<BenchSurface> Bench::createSurface(uint64_t time)
+{
+    std::unique_ptr<BenchSurface> surface(new BenchSurface);
+    std::memset(surface.get(), 0, sizeof(BenchSurface));
+    surface->bench = this;
+    surface->surface = wl_compositor_create_surface(m_compositor);
+    surface->nextCommit = time;
+    m_surfacesCreated++;
+    return surface;
+}
+
+void Bench::destroySurface(BenchSurface& surface)
+{
+    if (surface.frameCallback)
+        wl_callback_destroy(surface.frameCallback);
+    wl_surface_destroy(surface.surface);
+    for (auto& buffer : surface.buffers)
+        destroyBuffer(buffer);
+}
+
+const struct wl_callback_listener Bench::s_frameListener = {
+    // done
+    [](void* data, struct wl_callback*, uint32_t)
+    {
+        auto& surface = *static_cast<BenchSurface*>(data);
+        surface.bench->frameDone(surface);
+    }
+};
+
+void Bench::commit(BenchSurface& surface, uint64_t time)
+{
+    // Resize storms cycle through four sizes, from a quarter to the full
+    // size, so that every commit changes the buffer size.
+    int32_t width = m_options.width;
+    int32_t height = m_options.height;
+    if (m_options.pattern == Pattern::Resize) {
+        width = std::max(1, width * int32_t(1 + surface.frame % 4) / 4);
+        height = std::max(1, height * int32_t(1 + surface.frame % 4) / 4);
+    }
+
+    unsigned bufferCount = m_options.pattern == Pattern::Bursty ? m_options.burst + 1 : 2;
+    Buffer* buffer = nullptr;
+    for (unsigned i = 0; i < bufferCount; ++i) {
+        if (!surface.buffers[i].buffer || !surface.buffers[i].busy) {
+            buffer = &surface.buffers[i];
+            break;
+        }
+    }
+    if (!buffer) {
+        m_dropped++;
+        return;
+    }
+
+    if (buffer->buffer && (buffer->width != width || buffer->height != height))
+        destroyBuffer(*buffer);
+    if (!buffer->buffer && !createBuffer(*buffer, width, height)) {
+        std::fprintf(stderr, "athol-bench: cannot allocate a %dx%d buffer\n", width, height);
+        m_dropped++;
+        return;
+    }
+
+    // Stands in for rendering: every pixel changes on every frame.
+    uint32_t color = 0xff000000 | (surface.frame * 0x010203);
+    uint32_t* pixels = static_cast<uint32_t*>(buffer->data);
+    std::fill(pixels, pixels + buffer->size / 4, color);
+
+    wl_surface_attach(surface.surface, buffer->buffer, 0, 0);
+    wl_surface_damage(surface.surface, 0, 0, buffer->width, buffer->height);
+    if (!surface.frameCallback) {
+        surface.frameCallback = wl_surface_frame(surface.surface);
+        wl_callback_add_listener(surface.frameCallback, &s_frameListener, &surface);
+        surface.commitTime = time;
+    }
+    wl_surface_commit(surface.surface);
+    buffer->busy = true;
+
+    surface.frame++;
+    m_commits++;
+}
+
+void Bench::frameDone(BenchSurface& surface)
+{
+    wl_callback_destroy(surface.frameCallback);
+    surface.frameCallback = nullptr;
+
+    uint64_t time = now();
+    if (time < m_endTime) {
+        m_latencies.push_back(time - surface.commitTime);
+        m_frames++;
+    }
+
+    // Without a rate, surfaces draw again as soon as they are told to.
+    if (!period())
+        surface.nextCommit = time;
+}
+
+void Bench::run()
+{
+    m_startTime = now();
+    m_endTime = m_startTime + uint64_t(m_options.duration * 1000000000);
+
+    // Surfaces start spread over one period, as independent clients would.
+    for (unsigned i = 0; i < m_options.surfaces; ++i)
+        m_surfaces.push_back(createSurface(m_startTime + period() * i / m_options.surfaces));
+    if (m_options.pattern == Pattern::Churn && m_options.churnRate > 0)
+        m_nextChurn = m_startTime + uint64_t(1000000000 / m_options.churnRate);
+
+    int fd = wl_display_get_fd(m_display);
+    while (true) {
+        uint64_t time = now();
+        if (time >= m_endTime)
+            break;
+
+        if (m_nextChurn && time >= m_nextChurn && !m_surfaces.empty()) {
+            auto& surface = m_surfaces[m_nextSurface++ % m_surfaces.size()];
+            destroySurface(*surface);
+            surface = createSurface(time);
+            m_nextChurn += uint64_t(1000000000 / m_options.churnRate);
+        }
+
+        uint64_t next = m_endTime;
+        if (m_nextChurn)
+            next = std::min(next, m_nextChurn);
+
+        for (auto& surface : m_surfaces) {
+            if (surface->nextCommit == UINT64_MAX)
+                continue;
+
+            if (surface->nextCommit <= time) {
+                // A frame whose slot comes while the previous one is still
+                // waiting for its callback is dropped.
+                if (surface->frameCallback && period())
+                    m_dropped++;
+                else if (!surface->frameCallback) {
+                    unsigned commits = m_options.pattern == Pattern::Bursty ? m_options.burst : 1;
+                    for (unsigned i = 0; i < commits; ++i)
+                        commit(*surface, time);
+                }
+
+                if (period()) {
+                    do
+                        surface->nextCommit += period();
+                    while (surface->nextCommit <= time);
+                } else
+                    surface->nextCommit = UINT64_MAX;
+            }
+            next = std::min(next, surface->nextCommit);
+        }
+
+        while (wl_display_prepare_read(m_display))
+            wl_display_dispatch_pending(m_display);
+        if (wl_display_flush(m_display) == -1 && errno != EAGAIN) {
+            wl_display_cancel_read(m_display);
+            std::fprintf(stderr, "athol-bench: lost the connection\n");
+            break;
+        }
+
+        time = now();
+        int timeout = next > time ? int((next - time + 999999) / 1000000) : 0;
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        if (poll(&pfd, 1, timeout) > 0 && (pfd.revents & POLLIN)) {
+            if (wl_display_read_events(m_display) == -1) {
+                std::fprintf(stderr, "athol-bench: lost the connection\n");
+                break;
+            }
+        } else
+            wl_display_cancel_read(m_display);
+        wl_display_dispatch_pending(m_display);
+    }
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double fraction)
+{
+    if (sorted.empty())
+        return 0;
+    size_t index = std::min(sorted.size() - 1, size_t(fraction * sorted.size()));
+    return sorted[index];
+}
+
+bool Bench::writeResults(FILE* file) const
+{
+    static const char* patterns[] = { "steady", "bursty", "resize", "churn" };
+
+    std::vector<uint64_t> sorted = m_latencies;
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t sum = 0;
+    for (uint64_t latency : sorted)
+        sum += latency;
+
+    double duration = double(m_endTime - m_startTime) / 1000000000;
+    int ret = std::fprintf(file,
+        "{\"pattern\":\"%s\",\"surfaces\":%u,\"rate\":%.2f,\"width\":%d,\"height\":%d,\"duration\":%.3f,"
+        "\"surfacesCreated\":%llu,\"commits\":%llu,\"frames\":%llu,\"framesPerSecond\":%.2f,\"dropped\":%llu,"
+        "\"latency\":{\"count\":%zu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"max\":%llu}}\n",
+        patterns[int(m_options.pattern)], m_options.surfaces, m_options.rate, m_options.width, m_options.height, duration,
+        (unsigned long long)m_surfacesCreated, (unsigned long long)m_commits, (unsigned long long)m_frames,
+        duration > 0 ? m_frames / duration : 0.0, (unsigned long long)m_dropped,
+        sorted.size(), (unsigned long long)(sorted.empty() ? 0 : sum / sorted.size()),
+        (unsigned long long)percentile(sorted, 0.5), (unsigned long long)percentile(sorted, 0.9),
+        (unsigned long long)percentile(sorted, 0.99), (unsigned long long)(sorted.empty() ? 0 : sorted.back()));
+    return ret > 0;
+}
+
+static void usage()
+{
+    std::fprintf(stderr,
+        "Usage: athol-bench [options]\n"
+        "  --socket NAME        Wayland socket (default athol-0)\n"
+        "  --pattern PATTERN    steady, bursty, resize or churn (default steady)\n"
+        "  --surfaces N         Surfaces to open (default 4)\n"
+        "  --rate HZ            Commits per second per surface, 0 to follow\n"
+        "                       frame callbacks (default 60)\n"
+        "  --duration SECONDS   Length of the run (default 10)\n"
+        "  --size WxH           Buffer size (default 256x256)\n"
+        "  --burst N            Commits per burst with bursty, up to 7 (default 4)\n"
+        "  --churn-rate HZ      Surfaces recreated per second with churn (default 2)\n"
+        "  --output FILE        Where to write the JSON results (default stdout)\n");
+}
+
+int main(int argc, char** argv)
+{
+    Options options = { "athol-0", nullptr, Pattern::Steady, 4, 60, 10, 4, 2, 256, 256 };
+
+    for (int i = 1; i < argc; ++i) {
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (!std::strcmp(argv[i], "--help")) {
+            usage();
+            return EXIT_SUCCESS;
+        }
+        if (!value) {
+            usage();
+            return EXIT_FAILURE;
+        }
+
+        if (!std::strcmp(argv[i], "--socket"))
+            options.socket = value;
+        else if (!std::strcmp(argv[i], "--pattern")) {
+            if (!std::strcmp(value, "steady"))
+                options.pattern = Pattern::Steady;
+            else if (!std::strcmp(value, "bursty"))
+                options.pattern = Pattern::Bursty;
+            else if (!std::strcmp(value, "resize"))
+                options.pattern = Pattern::Resize;
+            else if (!std::strcmp(value, "churn"))
+                options.pattern = Pattern::Churn;
+            else {
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (!std::strcmp(argv[i], "--surfaces"))
+            options.surfaces = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(argv[i], "--rate"))
+            options.rate = std::atof(value);
+        else if (!std::strcmp(argv[i], "--duration"))
+            options.duration = std::atof(value);
+        else if (!std::strcmp(argv[i], "--size")) {
+            if (std::sscanf(value, "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (!std::strcmp(argv[i], "--burst"))
+            options.burst = std::min<unsigned long>(s_maxBuffers - 1, std::max(1ul, std::strtoul(value, nullptr, 10)));
+        else if (!std::strcmp(argv[i], "--churn-rate"))
+            options.churnRate = std::atof(value);
+        else if (!std::strcmp(argv[i], "--output"))
+            options.output = value;
+        else {
+            usage();
+            return EXIT_FAILURE;
+        }
+        ++i;
+    }
+
+    Bench bench(options);
+    if (!bench.initialize())
+        return EXIT_FAILURE;
+
+    bench.run();
+
+    FILE* file = options.output ? std::fopen(options.output, "w") : stdout;
+    if (!file) {
+        std::fprintf(stderr, "athol-bench: cannot open %s: %s\n", options.output, std::strerror(errno));
+        return EXIT_FAILURE;
+    }
+    bool written = bench.writeResults(file);
+    if (file != stdout)
+        std::fclose(file);
+    return written ? EXIT_SUCCESS : EXIT_FAILURE;
+}
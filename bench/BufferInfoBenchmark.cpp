@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Measures the CPU time the repaint path spends looking up buffer metadata,
+// with and without the per-wl_buffer cache. Each surface flips through a
+// swap chain of wl_buffers, as a GLES client would. The backend simulates
+// the cost of an EGL or VCHIQ round trip for every query it has to make, as
+// set with --query-cost, since the real ones need a VideoCore.
+
+#include "Backend.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+static uint64_t now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+class SimulatedBackend final : public Backend {
+public:
+    SimulatedBackend(uint64_t queryCost)
+        : m_queryCost(queryCost)
+        , m_queries(0)
+    { }
+
+    virtual bool initialize(CompletionCallback, void*) override { return true; }
+    virtual uint32_t width() const override { return 1920; }
+    virtual uint32_t height() const override { return 1080; }
+    virtual void setVblankCallback(VblankCallback, void*) override { }
+    virtual UpdateHandle startUpdate() override { return 1; }
+    virtual void submitUpdate(UpdateHandle) override { }
+    virtual ResourceHandle createResource(uint32_t, uint32_t, const void*, uint32_t) override { return 1; }
+    virtual void deleteResource(ResourceHandle) override { }
+    virtual ElementHandle addElement(UpdateHandle, int32_t, ResourceHandle, uint32_t, uint32_t, const Rect&, bool) override { return 1; }
+    virtual void removeElement(UpdateHandle, ElementHandle) override { }
+    virtual void changeElementAttributes(UpdateHandle, ElementHandle, int32_t, uint32_t, uint32_t, const Rect&) override { }
+    virtual void changeElementSource(UpdateHandle, ElementHandle, struct wl_resource*, const std::vector<Rect>&) override { }
+    virtual uint64_t uploadedBytes() const override { return 0; }
+
+    // What repaint did before the cache: EGL_WIDTH, EGL_HEIGHT and the
+    // dispmanx handle, on every frame.
+    bool queryBufferInfoUncached(struct wl_resource* buffer, BufferInfo& info) { return queryBufferInfo(buffer, info); }
+
+    uint64_t queries() const { return m_queries; }
+
+private:
+    virtual bool queryBufferInfo(struct wl_resource*, BufferInfo& info) override
+    {
+        for (int i = 0; i < 3; ++i)
+            simulateQuery();
+
+        info.width = 1280;
+        info.height = 720;
+        info.shm = false;
+        info.shmFormat = 0;
+        info.handle = 1;
+        return true;
+    }
+
+    void simulateQuery()
+    {
+        ++m_queries;
+        uint64_t end = now(CLOCK_MONOTONIC) + m_queryCost;
+        while (now(CLOCK_MONOTONIC) < end) { }
+    }
+
+    uint64_t m_queryCost;
+    uint64_t m_queries;
+};
+
+struct Result {
+    double cpuPerFrame;
+    double queriesPerFrame;
+};
+
+static Result run(SimulatedBackend& backend, const std::vector<struct wl_resource*>& buffers, unsigned surfaces, unsigned swapChainLength, unsigned frames, bool cached)
+{
+    uint64_t queries = backend.queries();
+    uint64_t start = now(CLOCK_THREAD_CPUTIME_ID);
+
+    int64_t checksum = 0;
+    for (unsigned frame = 0; frame < frames; ++frame) {
+        for (unsigned surface = 0; surface < surfaces; ++surface) {
+            struct wl_resource* buffer = buffers[surface * swapChainLength + frame % swapChainLength];
+            if (cached) {
+                const Backend::BufferInfo* info = backend.bufferInfo(buffer);
+                checksum += info->width + info->height + info->handle;
+            } else {
+                Backend::BufferInfo info;
+                backend.queryBufferInfoUncached(buffer, info);
+                checksum += info.width + info.height + info.handle;
+            }
+        }
+    }
+
+    uint64_t cpu = now(CLOCK_THREAD_CPUTIME_ID) - start;
+    if (!checksum)
+        std::fprintf(stderr, "unexpected checksum\n");
+    return { double(cpu) / frames / 1000, double(backend.queries() - queries) / frames };
+}
+
+int main(int argc, char** argv)
+{
+    unsigned frames = 600;
+    unsigned surfaces = 4;
+    unsigned swapChainLength = 3;
+    uint64_t queryCost = 20000;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--frames"))
+            frames = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--surfaces"))
+            surfaces = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--swap-chain"))
+            swapChainLength = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--query-cost"))
+            queryCost = std::strtoull(argv[i + 1], nullptr, 10);
+        else {
+            std::fprintf(stderr, "usage: %s [--frames N] [--surfaces N] [--swap-chain N] [--query-cost ns]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!frames || !surfaces || !swapChainLength) {
+        std::fprintf(stderr, "frames, surfaces and swap chain length must not be 0\n");
+        return EXIT_FAILURE;
+    }
+
+    // Real wl_buffer resources, so that the cache's destroy listeners are
+    // exercised as in the compositor.
+    struct wl_display* display = wl_display_create();
+    int fds[2];
+    if (!display || socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        return EXIT_FAILURE;
+    struct wl_client* client = wl_client_create(display, fds[0]);
+
+    std::vector<struct wl_resource*> buffers;
+    for (unsigned i = 0; i < surfaces * swapChainLength; ++i)
+        buffers.push_back(wl_resource_create(client, &wl_buffer_interface, 1, 0));
+
+    SimulatedBackend backend(queryCost);
+    Result uncached = run(backend, buffers, surfaces, swapChainLength, frames, false);
+    Result cached = run(backend, buffers, surfaces, swapChainLength, frames, true);
+
+    std::printf("%u surfaces, %u-buffer swap chains, %llu ns per query, %u frames\n",
+        surfaces, swapChainLength, (unsigned long long)queryCost, frames);
+    std::printf("uncached: %8.2f us CPU per frame, %6.2f queries per frame\n", uncached.cpuPerFrame, uncached.queriesPerFrame);
+    std::printf("cached:   %8.2f us CPU per frame, %6.2f queries per frame\n", cached.cpuPerFrame, cached.queriesPerFrame);
+
+    wl_client_destroy(client);
+    close(fds[1]);
+    wl_display_destroy(display);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,842 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Microbenchmarks of the compositor's hot paths, run against the stub
+// bcm_host, dispmanx, EGL and libinput library in stub/, so that they need
+// no VideoCore. Each benchmark reports the wall time per operation and the
+// number of operator new calls per operation, taken only while timing, and
+// can be written out as JSON for comparing builds.
+//
+// The frame clock is inhibited and repaints are driven by hand. Clients
+// talk to the compositor over a socketpair, from the same thread.
+
+#include "Athol.h"
+#include "Output.h"
+#include "Presentation.h"
+#include "Region.h"
+#include "Surface.h"
+#include "stub/Stub.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <string>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <wayland-client.h>
+
+static std::atomic<bool> s_countAllocations(false);
+static std::atomic<uint64_t> s_allocations(0);
+
+void* operator new(size_t size)
+{
+    if (s_countAllocations.load(std::memory_order_relaxed))
+        s_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* pointer = std::malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* pointer) noexcept
+{
+    std::free(pointer);
+}
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+class State {
+public:
+    State(int64_t arg, uint64_t iterations)
+        : m_arg(arg)
+        , m_iterations(iterations)
+        , m_remaining(iterations)
+        , m_started(false)
+        , m_elapsed(0)
+        , m_allocations(0)
+        , m_start(0)
+        , m_startAllocations(0)
+    { }
+
+    // Timing starts with the first call and stops once all iterations ran.
+    bool keepRunning()
+    {
+        if (!m_started) {
+            m_started = true;
+            resumeTiming();
+        }
+        if (m_remaining) {
+            --m_remaining;
+            return true;
+        }
+        pauseTiming();
+        return false;
+    }
+
+    void pauseTiming()
+    {
+        m_elapsed += now() - m_start;
+        s_countAllocations = false;
+        m_allocations += s_allocations - m_startAllocations;
+    }
+
+    void resumeTiming()
+    {
+        m_startAllocations = s_allocations;
+        s_countAllocations = true;
+        m_start = now();
+    }
+
+    void skip(const char* reason) { m_error = reason; }
+
+    int64_t arg() const { return m_arg; }
+    uint64_t iterations() const { return m_iterations; }
+    uint64_t elapsed() const { return m_elapsed; }
+    uint64_t allocations() const { return m_allocations; }
+    const std::string& error() const { return m_error; }
+
+private:
+    int64_t m_arg;
+    uint64_t m_iterations;
+    uint64_t m_remaining;
+    bool m_started;
+    uint64_t m_elapsed;
+    uint64_t m_allocations;
+    uint64_t m_start;
+    uint64_t m_startAllocations;
+    std::string m_error;
+};
+
+class NullInputClient final : public API::InputClient {
+public:
+    virtual void handleKeyboardEvent(uint32_t, uint32_t, uint32_t) override { }
+    virtual void handlePointerMotion(uint32_t, double, double) override { }
+    virtual void handlePointerButton(uint32_t, uint32_t, uint32_t) override { }
+};
+
+// A compositor on the stub display, and one client of it.
+class Compositor {
+public:
+    struct ClientSurface {
+        struct wl_surface* surface;
+        struct wl_buffer* buffers[2];
+        unsigned frame;
+        Surface* server;
+    };
+
+    Compositor();
+    ~Compositor();
+
+    bool initialize();
+    bool createSurfaces(unsigned count, int32_t size);
+
+    Athol& athol() { return m_athol; }
+    Output& output() { return m_athol.output(0); }
+    struct wl_event_loop* loop() { return wl_display_get_event_loop(m_athol.display()); }
+    struct wl_client* serverClient() { return m_serverClient; }
+    struct wl_subcompositor* subcompositor() { return m_subcompositor; }
+    std::vector<ClientSurface>& surfaces() { return m_surfaces; }
+
+    // Damages a corner of the surface and commits its other buffer,
+    // requesting the given number of frame callbacks.
+    void commit(ClientSurface&, unsigned frameCallbacks = 0);
+    void commitAll();
+
+    // Both ends dispatch what the other sent, once, or until the
+    // compositor has processed everything the client sent so far.
+    void pump();
+    bool roundtrip();
+
+    // Waits for the stub display to complete the submitted updates, and
+    // dispatches their completion.
+    void completeUpdates();
+
+private:
+    static const struct wl_registry_listener s_registryListener;
+    static const struct wl_callback_listener s_frameListener;
+
+    Athol m_athol;
+    struct wl_client* m_serverClient;
+
+    struct wl_display* m_display;
+    struct wl_compositor* m_compositor;
+    struct wl_subcompositor* m_subcompositor;
+    struct wl_shm* m_shm;
+    std::vector<ClientSurface> m_surfaces;
+};
+
+Compositor::Compositor()
+    : m_athol("athol-benchmark")
+    , m_serverClient(nullptr)
+    , m_display(nullptr)
+    , m_compositor(nullptr)
+    , m_subcompositor(nullptr)
+    , m_shm(nullptr)
+{
+}
+
+Compositor::~Compositor()
+{
+    for (auto& surface : m_surfaces) {
+        wl_buffer_destroy(surface.buffers[0]);
+        wl_buffer_destroy(surface.buffers[1]);
+        wl_surface_destroy(surface.surface);
+    }
+    if (m_shm)
+        wl_shm_destroy(m_shm);
+    if (m_subcompositor)
+        wl_subcompositor_destroy(m_subcompositor);
+    if (m_compositor)
+        wl_compositor_destroy(m_compositor);
+    if (m_display)
+        wl_display_disconnect(m_display);
+}
+
+bool Compositor::initialize()
+{
+    if (!m_athol.finishStartup())
+        return false;
+    for (unsigned i = 0; i < m_athol.outputCount(); ++i)
+        m_athol.output(i).frameClock().setInhibited(true);
+    m_athol.initializeInput(std::unique_ptr<API::InputClient>(new NullInputClient));
+
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) == -1)
+        return false;
+    m_serverClient = wl_client_create(m_athol.display(), fds[0]);
+    m_display = wl_display_connect_to_fd(fds[1]);
+    if (!m_serverClient || !m_display)
+        return false;
+
+    struct wl_registry* registry = wl_display_get_registry(m_display);
+    wl_registry_add_listener(registry, &s_registryListener, this);
+    bool connected = roundtrip();
+    wl_registry_destroy(registry);
+    return connected && m_compositor && m_subcompositor && m_shm;
+}
+
+bool Compositor::createSurfaces(unsigned count, int32_t size)
+{
+    // The compositor maps the pool, the client never touches it.
+    std::string path = "/tmp/athol-compositor-benchmark-XXXXXX";
+    int fd = mkostemp(&path[0], O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    unlink(path.c_str());
+
+    int32_t stride = size * 4;
+    int32_t bufferSize = stride * size;
+    if (ftruncate(fd, off_t(bufferSize) * 2 * count) == -1) {
+        close(fd);
+        return false;
+    }
+
+    struct wl_shm_pool* pool = wl_shm_create_pool(m_shm, fd, bufferSize * 2 * count);
+    close(fd);
+
+    for (unsigned i = 0; i < count; ++i) {
+        ClientSurface surface;
+        surface.surface = wl_compositor_create_surface(m_compositor);
+        for (unsigned j = 0; j < 2; ++j)
+            surface.buffers[j] = wl_shm_pool_create_buffer(pool, (i * 2 + j) * bufferSize, size, size, stride, WL_SHM_FORMAT_XRGB8888);
+        surface.frame = 0;
+        surface.server = nullptr;
+        m_surfaces.push_back(surface);
+    }
+    wl_shm_pool_destroy(pool);
+
+    if (!roundtrip())
+        return false;
+
+    for (auto& surface : m_surfaces) {
+        uint32_t id = wl_proxy_get_id(reinterpret_cast<struct wl_proxy*>(surface.surface));
+        surface.server = Surface::fromResource(wl_client_get_object(m_serverClient, id));
+    }
+
+    // The first frame creates the elements.
+    commitAll();
+    output().repaint();
+    completeUpdates();
+    return true;
+}
+
+void Compositor::commit(ClientSurface& surface, unsigned frameCallbacks)
+{
+    for (unsigned i = 0; i < frameCallbacks; ++i)
+        wl_callback_add_listener(wl_surface_frame(surface.surface), &s_frameListener, nullptr);
+
+    wl_surface_attach(surface.surface, surface.buffers[surface.frame++ & 1], 0, 0);
+    wl_surface_damage_buffer(surface.surface, 0, 0, 16, 16);
+    wl_surface_commit(surface.surface);
+}
+
+void Compositor::commitAll()
+{
+    for (auto& surface : m_surfaces)
+        commit(surface);
+    roundtrip();
+}
+
+void Compositor::pump()
+{
+    wl_display_flush(m_display);
+    wl_event_loop_dispatch(loop(), 0);
+    wl_display_flush_clients(m_athol.display());
+
+    while (wl_display_prepare_read(m_display))
+        wl_display_dispatch_pending(m_display);
+    struct pollfd pollfd = { wl_display_get_fd(m_display), POLLIN, 0 };
+    if (poll(&pollfd, 1, 0) > 0)
+        wl_display_read_events(m_display);
+    else
+        wl_display_cancel_read(m_display);
+    wl_display_dispatch_pending(m_display);
+}
+
+bool Compositor::roundtrip()
+{
+    static const struct wl_callback_listener syncListener = {
+        // done
+        [](void* data, struct wl_callback* callback, uint32_t)
+        {
+            *static_cast<bool*>(data) = true;
+            wl_callback_destroy(callback);
+        }
+    };
+
+    bool done = false;
+    wl_callback_add_listener(wl_display_sync(m_display), &syncListener, &done);
+    while (!done) {
+        if (wl_display_get_error(m_display))
+            return false;
+        pump();
+    }
+    return true;
+}
+
+void Compositor::completeUpdates()
+{
+    Stub::waitForUpdates();
+    pump();
+}
+
+const struct wl_registry_listener Compositor::s_registryListener = {
+    // global
+    [](void* data, struct wl_registry* registry, uint32_t name, const char* interface, uint32_t)
+    {
+        auto& compositor = *static_cast<Compositor*>(data);
+        if (!std::strcmp(interface, "wl_compositor"))
+            compositor.m_compositor = static_cast<struct wl_compositor*>(wl_registry_bind(registry, name, &wl_compositor_interface, 4));
+        else if (!std::strcmp(interface, "wl_subcompositor"))
+            compositor.m_subcompositor = static_cast<struct wl_subcompositor*>(wl_registry_bind(registry, name, &wl_subcompositor_interface, 1));
+        else if (!std::strcmp(interface, "wl_shm"))
+            compositor.m_shm = static_cast<struct wl_shm*>(wl_registry_bind(registry, name, &wl_shm_interface, 1));
+    },
+    // global_remove
+    [](void*, struct wl_registry*, uint32_t) { }
+};
+
+const struct wl_callback_listener Compositor::s_frameListener = {
+    // done
+    [](void*, struct wl_callback* callback, uint32_t)
+    {
+        wl_callback_destroy(callback);
+    }
+};
+
+// A full repaint of arg() surfaces that all committed a new buffer.
+static void outputRepaint(State& state)
+{
+    Compositor compositor;
+    if (!compositor.initialize() || !compositor.createSurfaces(state.arg(), 128)) {
+        state.skip("cannot set up the compositor");
+        return;
+    }
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        compositor.commitAll();
+        state.resumeTiming();
+
+        compositor.output().repaint();
+
+        state.pauseTiming();
+        compositor.completeUpdates();
+        state.resumeTiming();
+    }
+}
+
+// Surface::repaint of arg() surfaces that all committed a new buffer, with
+// the update submitted outside of the timing.
+static void surfaceRepaint(State& state)
+{
+    Compositor compositor;
+    if (!compositor.initialize() || !compositor.createSurfaces(state.arg(), 128)) {
+        state.skip("cannot set up the compositor");
+        return;
+    }
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        compositor.commitAll();
+        Output::Update& update = compositor.output().frameUpdate();
+        state.resumeTiming();
+
+        for (auto& surface : compositor.surfaces())
+            surface.server->repaint(update);
+
+        state.pauseTiming();
+        compositor.output().repaint();
+        compositor.completeUpdates();
+        state.resumeTiming();
+    }
+}
+
+// Completing arg() frame callbacks of one surface.
+static void dispatchFrameCallbacks(State& state)
+{
+    Compositor compositor;
+    if (!compositor.initialize() || !compositor.createSurfaces(1, 128)) {
+        state.skip("cannot set up the compositor");
+        return;
+    }
+
+    auto& surface = compositor.surfaces().front();
+    Presentation::Timing timing = { 0, compositor.output().frameClock().refreshInterval(), 0, 0, nullptr };
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        compositor.commit(surface, state.arg());
+        compositor.roundtrip();
+        compositor.output().repaint();
+        timing.time = now();
+        state.resumeTiming();
+
+        surface.server->dispatchFrameCallbacks(UINT64_MAX, timing);
+
+        state.pauseTiming();
+        compositor.completeUpdates();
+        state.resumeTiming();
+    }
+}
+
+// Creating and destroying a surface, without the protocol around it.
+static void surfaceCreateDestroy(State& state)
+{
+    Compositor compositor;
+    if (!compositor.initialize()) {
+        state.skip("cannot set up the compositor");
+        return;
+    }
+
+    struct wl_resource* compositorResource = wl_resource_create(compositor.serverClient(), &wl_compositor_interface, 4, 0);
+    while (state.keepRunning()) {
+        auto* surface = new Surface(compositor.output(), compositor.serverClient(), compositorResource, 0);
+        wl_resource_destroy(surface->resource());
+    }
+    wl_resource_destroy(compositorResource);
+}
+
+// Reading arg() input events from libinput and handing them to the shell.
+static void inputProcessEvents(State& state)
+{
+    Compositor compositor;
+    if (!compositor.initialize()) {
+        state.skip("cannot set up the compositor");
+        return;
+    }
+    while (!compositor.athol().input().isInitialized())
+        wl_event_loop_dispatch(compositor.loop(), -1);
+
+    while (state.keepRunning()) {
+        state.pauseTiming();
+        for (int64_t i = 0; i < state.arg(); ++i) {
+            switch (i % 4) {
+            case 0:
+                Stub::queuePointerMotion(1, 1);
+                break;
+            case 1:
+                Stub::queuePointerButton(0x110, !(i & 4));
+                break;
+            case 2:
+                Stub::queuePointerAxis(10, 0);
+                break;
+            case 3:
+                Stub::queueKeyboardKey(30, !(i & 4));
+                break;
+            }
+        }
+        state.resumeTiming();
+
+        wl_event_loop_dispatch(compositor.loop(), 0);
+
+        state.pauseTiming();
+        compositor.athol().flushInput();
+        state.resumeTiming();
+    }
+}
+
+// Windows overlapping like a cascade, arg() of them.
+static std::vector<Region::Rect> cascade(int64_t count)
+{
+    std::vector<Region::Rect> rects;
+    for (int64_t i = 0; i < count; ++i)
+        rects.push_back({ int32_t(i * 37 % 1600), int32_t(i * 23 % 900), 320, 240 });
+    return rects;
+}
+
+// Uniting the opaque regions of arg() surfaces, as occlusion culling does
+// on each repaint.
+static void regionUnite(State& state)
+{
+    std::vector<Region::Rect> rects = cascade(state.arg());
+    while (state.keepRunning()) {
+        Region covered;
+        for (auto& rect : rects)
+            covered.unite(rect);
+    }
+}
+
+// Hit testing a point against a region of the cascade of arg() surfaces,
+// as pointer focus does on each motion event.
+static void regionContainsPoint(State& state)
+{
+    Region region;
+    for (auto& rect : cascade(state.arg()))
+        region.unite(rect);
+
+    uint32_t point = 0;
+    volatile bool hit;
+    while (state.keepRunning()) {
+        point = point * 1103515245 + 12345;
+        hit = region.contains(int32_t(point % 1920), int32_t((point >> 16) % 1080));
+    }
+    (void)hit;
+}
+
+// Region operations are checked against a brute-force pixel mask before
+// they are timed, on random rectangles in a small grid so that edges keep
+// meeting.
+static const int32_t s_maskSize = 24;
+using Mask = std::vector<bool>;
+
+static Region::Rect randomRect(uint32_t& seed)
+{
+    auto next = [&seed](int32_t range) {
+        seed = seed * 1103515245 + 12345;
+        return int32_t((seed >> 16) % range);
+    };
+    int32_t x = next(s_maskSize);
+    int32_t y = next(s_maskSize);
+    return { x, y, next(s_maskSize - x + 1), next(s_maskSize - y + 1) };
+}
+
+static void paintMask(Mask& mask, const Region::Rect& rect, bool value)
+{
+    for (int32_t y = rect.y; y < rect.y + rect.height; ++y) {
+        for (int32_t x = rect.x; x < rect.x + rect.width; ++x)
+            mask[y * s_maskSize + x] = value;
+    }
+}
+
+// The pixels of a region, or an empty mask if its rectangles overlap or
+// leave the grid.
+static Mask regionMask(const Region& region)
+{
+    Mask mask(s_maskSize * s_maskSize, false);
+    bool valid = true;
+    region.forEachRect([&](const Region::Rect& rect) {
+        if (rect.x < 0 || rect.y < 0 || rect.x + rect.width > s_maskSize || rect.y + rect.height > s_maskSize) {
+            valid = false;
+            return;
+        }
+        for (int32_t y = rect.y; y < rect.y + rect.height; ++y) {
+            for (int32_t x = rect.x; x < rect.x + rect.width; ++x) {
+                valid = valid && !mask[y * s_maskSize + x];
+                mask[y * s_maskSize + x] = true;
+            }
+        }
+    });
+    return valid ? mask : Mask();
+}
+
+static bool checkRegions()
+{
+    static const char* names[] = { "union", "intersection", "subtraction" };
+    uint32_t seed = 1;
+    for (unsigned i = 0; i < 10000; ++i) {
+        Region a, b;
+        Mask aMask(s_maskSize * s_maskSize, false);
+        Mask bMask(s_maskSize * s_maskSize, false);
+        for (unsigned j = i % 6; j > 0; --j) {
+            Region::Rect rect = randomRect(seed);
+            bool subtract = !(j % 3);
+            if (subtract)
+                a.subtract(rect);
+            else
+                a.unite(rect);
+            paintMask(aMask, rect, !subtract);
+        }
+        for (unsigned j = i / 6 % 6; j > 0; --j) {
+            Region::Rect rect = randomRect(seed);
+            b.unite(rect);
+            paintMask(bMask, rect, true);
+        }
+
+        for (unsigned operation = 0; operation < 3; ++operation) {
+            Region result = a;
+            Mask expected(aMask.size());
+            for (size_t k = 0; k < expected.size(); ++k) {
+                if (operation == 0)
+                    expected[k] = aMask[k] || bMask[k];
+                else if (operation == 1)
+                    expected[k] = aMask[k] && bMask[k];
+                else
+                    expected[k] = aMask[k] && !bMask[k];
+            }
+            if (operation == 0)
+                result.unite(b);
+            else if (operation == 1)
+                result.intersect(b);
+            else
+                result.subtract(b);
+
+            if (regionMask(result) != expected) {
+                std::fprintf(stderr, "Region %s differs from the pixel mask in case %u\n", names[operation], i);
+                return false;
+            }
+            for (int32_t y = 0; y < s_maskSize; ++y) {
+                for (int32_t x = 0; x < s_maskSize; ++x) {
+                    if (result.contains(x, y) != expected[y * s_maskSize + x]) {
+                        std::fprintf(stderr, "Region %s misses point %d,%d in case %u\n", names[operation], x, y, i);
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// A top-level surface scaled from 256x256 to the whole output, with a
+// 64x64 subsurface at (32, 16), which has to be placed and sized in the
+// parent's surface coordinates, and hit tested back into its own.
+static bool checkScaledSubsurface()
+{
+    Compositor compositor;
+    if (!compositor.initialize() || !compositor.createSurfaces(1, 256) || !compositor.createSurfaces(1, 64)) {
+        std::fprintf(stderr, "Cannot set up the compositor for the subsurface check\n");
+        return false;
+    }
+
+    auto& parent = compositor.surfaces()[0];
+    auto& child = compositor.surfaces()[1];
+    struct wl_subsurface* subsurface = wl_subcompositor_get_subsurface(compositor.subcompositor(), child.surface, parent.surface);
+    wl_subsurface_set_position(subsurface, 32, 16);
+    compositor.commit(child);
+    compositor.commit(parent);
+    bool connected = compositor.roundtrip();
+    compositor.output().repaint();
+    compositor.completeUpdates();
+
+    double scaleX = compositor.output().width() / 256.0;
+    double scaleY = compositor.output().height() / 256.0;
+    Backend::Rect expected = { int32_t(std::lround(32 * scaleX)), int32_t(std::lround(16 * scaleY)),
+        int32_t(std::lround(64 * scaleX)), int32_t(std::lround(64 * scaleY)) };
+    Backend::Rect extent = child.server->extent();
+
+    double surfaceX, surfaceY;
+    child.server->toSurfaceCoordinates(expected.x + expected.width / 2.0, expected.y + expected.height / 2.0, surfaceX, surfaceY);
+
+    wl_subsurface_destroy(subsurface);
+    compositor.roundtrip();
+
+    if (!connected || extent.x != expected.x || extent.y != expected.y
+        || extent.width != expected.width || extent.height != expected.height) {
+        std::fprintf(stderr, "Scaled subsurface at %d,%d %dx%d instead of %d,%d %dx%d\n",
+            extent.x, extent.y, extent.width, extent.height, expected.x, expected.y, expected.width, expected.height);
+        return false;
+    }
+    if (std::fabs(surfaceX - 32) > 1 || std::fabs(surfaceY - 32) > 1) {
+        std::fprintf(stderr, "The center of the scaled subsurface maps to %.1f,%.1f instead of 32,32\n", surfaceX, surfaceY);
+        return false;
+    }
+    return true;
+}
+
+struct Benchmark {
+    const char* name;
+    void (*function)(State&);
+    std::vector<int64_t> args;
+};
+
+static const Benchmark s_benchmarks[] = {
+    { "OutputRepaint", outputRepaint, { 1, 16, 64 } },
+    { "SurfaceRepaint", surfaceRepaint, { 1, 16, 64 } },
+    { "DispatchFrameCallbacks", dispatchFrameCallbacks, { 1, 16, 256 } },
+    { "SurfaceCreateDestroy", surfaceCreateDestroy, { 0 } },
+    { "InputProcessEvents", inputProcessEvents, { 1, 16, 256 } },
+    { "RegionUnite", regionUnite, { 1, 16, 64 } },
+    { "RegionContainsPoint", regionContainsPoint, { 1, 16, 64 } },
+};
+
+static const uint64_t s_maxIterations = 1000000000;
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double nsPerOp;
+    double allocationsPerOp;
+    std::string error;
+};
+
+static std::string benchmarkName(const Benchmark& benchmark, int64_t arg)
+{
+    std::string name = benchmark.name;
+    if (benchmark.args.size() > 1)
+        name += "/" + std::to_string(arg);
+    return name;
+}
+
+// Grows the iteration count until a run takes at least minTime.
+static Result run(const Benchmark& benchmark, int64_t arg, uint64_t minTime)
+{
+    Result result;
+    result.name = benchmarkName(benchmark, arg);
+
+    uint64_t iterations = 1;
+    while (true) {
+        State state(arg, iterations);
+        benchmark.function(state);
+        if (!state.error().empty()) {
+            result.iterations = 0;
+            result.nsPerOp = 0;
+            result.allocationsPerOp = 0;
+            result.error = state.error();
+            return result;
+        }
+
+        if (state.elapsed() >= minTime || iterations >= s_maxIterations) {
+            result.iterations = iterations;
+            result.nsPerOp = double(state.elapsed()) / iterations;
+            result.allocationsPerOp = double(state.allocations()) / iterations;
+            return result;
+        }
+
+        double multiplier = state.elapsed() ? 1.4 * minTime / state.elapsed() : 10;
+        multiplier = std::min(std::max(multiplier, 2.0), 10.0);
+        iterations = std::min<uint64_t>(iterations * multiplier, s_maxIterations);
+    }
+}
+
+static bool writeJson(const char* path, const std::vector<Result>& results)
+{
+    FILE* file = std::fopen(path, "w");
+    if (!file)
+        return false;
+
+    std::fprintf(file, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        std::fprintf(file, "    { \"name\": \"%s\", \"iterations\": %llu, \"nsPerOp\": %.2f, \"allocationsPerOp\": %.2f%s%s%s }%s\n",
+            result.name.c_str(), (unsigned long long)result.iterations, result.nsPerOp, result.allocationsPerOp,
+            result.error.empty() ? "" : ", \"error\": \"", result.error.c_str(), result.error.empty() ? "" : "\"",
+            i + 1 < results.size() ? "," : "");
+    }
+    std::fprintf(file, "  ]\n}\n");
+    return !std::fclose(file);
+}
+
+int main(int argc, char** argv)
+{
+    double minTime = 0.5;
+    const char* filter = nullptr;
+    const char* jsonPath = nullptr;
+
+    static const char* usage = "usage: %s [--min-time seconds] [--filter substring] [--json FILE]\n";
+    if (argc % 2 == 0) {
+        std::fprintf(stderr, usage, argv[0]);
+        return EXIT_FAILURE;
+    }
+    for (int i = 1; i < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--min-time"))
+            minTime = std::atof(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--filter"))
+            filter = argv[i + 1];
+        else if (!std::strcmp(argv[i], "--json"))
+            jsonPath = argv[i + 1];
+        else {
+            std::fprintf(stderr, usage, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (!checkRegions())
+        return EXIT_FAILURE;
+
+    // Unless overridden, updates complete as soon as they are submitted.
+    setenv("ATHOL_BACKEND", "rpi", 1);
+    setenv("ATHOL_STUB_REFRESH", "0", 0);
+
+    if (!checkScaledSubsurface())
+        return EXIT_FAILURE;
+
+    std::vector<Result> results;
+    std::printf("%-32s %12s %14s %12s\n", "Benchmark", "Iterations", "ns/op", "allocs/op");
+    for (auto& benchmark : s_benchmarks) {
+        for (int64_t arg : benchmark.args) {
+            if (filter && benchmarkName(benchmark, arg).find(filter) == std::string::npos)
+                continue;
+
+            Result result = run(benchmark, arg, uint64_t(minTime * 1000000000));
+            if (!result.error.empty())
+                std::printf("%-32s ERROR: %s\n", result.name.c_str(), result.error.c_str());
+            else
+                std::printf("%-32s %12llu %14.1f %12.2f\n", result.name.c_str(), (unsigned long long)result.iterations, result.nsPerOp, result.allocationsPerOp);
+            std::fflush(stdout);
+            results.push_back(result);
+        }
+    }
+
+    if (jsonPath && !writeJson(jsonPath, results)) {
+        std::fprintf(stderr, "cannot write %s\n", jsonPath);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
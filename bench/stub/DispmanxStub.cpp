@@ -0,0 +1,337 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Stands in for bcm_host, dispmanx and the EGL entry points the dispmanx
+// backend looks up. Calls are counted rather than carried out, and a
+// display thread plays the part of the HVS, completing submitted updates
+// and calling the vsync callbacks once per simulated vblank.
+
+#include "Stub.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define BUILD_WAYLAND
+#include <bcm_host.h>
+
+namespace {
+
+struct PendingUpdate {
+    DISPMANX_UPDATE_HANDLE_T update;
+    DISPMANX_CALLBACK_FUNC_T callback;
+    void* data;
+};
+
+struct VsyncCallback {
+    DISPMANX_DISPLAY_HANDLE_T display;
+    DISPMANX_CALLBACK_FUNC_T callback;
+    void* data;
+};
+
+// Callbacks are made with the mutex held, so none is running once the
+// backend has unregistered it or closed its display.
+struct DisplayThread {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+    std::thread thread;
+    bool stopping = false;
+    unsigned openDisplays = 0;
+    std::vector<PendingUpdate> pendingUpdates;
+    std::vector<VsyncCallback> vsyncCallbacks;
+};
+
+}
+
+static DisplayThread s_display;
+static std::atomic<uint32_t> s_nextHandle(1);
+static Stub::DispmanxCalls s_calls;
+
+static uint32_t nextHandle()
+{
+    return s_nextHandle++;
+}
+
+static void vblank()
+{
+    for (auto& vsync : s_display.vsyncCallbacks)
+        vsync.callback(0, vsync.data);
+
+    for (auto& pending : s_display.pendingUpdates) {
+        if (pending.callback)
+            pending.callback(pending.update, pending.data);
+    }
+    s_display.pendingUpdates.clear();
+    s_display.idle.notify_all();
+}
+
+static void displayThreadLoop(unsigned refreshRate)
+{
+    using Clock = std::chrono::steady_clock;
+    auto interval = std::chrono::nanoseconds(refreshRate ? 1000000000 / refreshRate : 0);
+    auto next = Clock::now() + interval;
+
+    std::unique_lock<std::mutex> lock(s_display.mutex);
+    while (true) {
+        if (refreshRate) {
+            s_display.wake.wait_until(lock, next, [] { return s_display.stopping; });
+
+            // Skips the vblanks missed while descheduled, as the HVS would.
+            next += interval;
+            auto now = Clock::now();
+            if (next < now)
+                next = now + interval;
+        } else
+            s_display.wake.wait(lock, [] { return s_display.stopping || !s_display.pendingUpdates.empty(); });
+
+        if (s_display.stopping)
+            return;
+        vblank();
+    }
+}
+
+extern "C" {
+
+void bcm_host_init(void)
+{
+}
+
+void bcm_host_deinit(void)
+{
+}
+
+int32_t graphics_get_display_size(const uint16_t display, uint32_t* width, uint32_t* height)
+{
+    switch (display) {
+    case DISPMANX_ID_HDMI:
+        *width = 1920;
+        *height = 1080;
+        return 0;
+    case DISPMANX_ID_MAIN_LCD:
+        *width = 800;
+        *height = 480;
+        return 0;
+    default:
+        return -1;
+    }
+}
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device)
+{
+    if (device != DISPMANX_ID_HDMI && device != DISPMANX_ID_MAIN_LCD)
+        return DISPMANX_NO_HANDLE;
+
+    std::lock_guard<std::mutex> lock(s_display.mutex);
+    if (!s_display.openDisplays++) {
+        const char* refresh = getenv("ATHOL_STUB_REFRESH");
+        s_display.stopping = false;
+        s_display.thread = std::thread(displayThreadLoop, refresh ? std::atoi(refresh) : 60);
+    }
+    return nextHandle();
+}
+
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T display)
+{
+    std::unique_lock<std::mutex> lock(s_display.mutex);
+    auto& callbacks = s_display.vsyncCallbacks;
+    for (auto it = callbacks.begin(); it != callbacks.end();) {
+        if (it->display == display)
+            it = callbacks.erase(it);
+        else
+            ++it;
+    }
+
+    if (--s_display.openDisplays)
+        return 0;
+
+    // Whatever is still in flight never completes, the compositor is going
+    // away with the outputs it would have notified.
+    s_display.pendingUpdates.clear();
+    s_display.stopping = true;
+    s_display.wake.notify_all();
+    s_display.idle.notify_all();
+    lock.unlock();
+
+    s_display.thread.join();
+    return 0;
+}
+
+int vc_dispmanx_vsync_callback(DISPMANX_DISPLAY_HANDLE_T display, DISPMANX_CALLBACK_FUNC_T callback, void* data)
+{
+    std::lock_guard<std::mutex> lock(s_display.mutex);
+    auto& callbacks = s_display.vsyncCallbacks;
+    for (auto it = callbacks.begin(); it != callbacks.end(); ++it) {
+        if (it->display == display) {
+            callbacks.erase(it);
+            break;
+        }
+    }
+    if (callback)
+        callbacks.push_back({ display, callback, data });
+    return 0;
+}
+
+DISPMANX_UPDATE_HANDLE_T vc_dispmanx_update_start(int32_t)
+{
+    s_calls.updateStart++;
+    return nextHandle();
+}
+
+int vc_dispmanx_update_submit(DISPMANX_UPDATE_HANDLE_T update, DISPMANX_CALLBACK_FUNC_T callback, void* data)
+{
+    s_calls.updateSubmit++;
+
+    std::lock_guard<std::mutex> lock(s_display.mutex);
+    s_display.pendingUpdates.push_back({ update, callback, data });
+    s_display.wake.notify_all();
+    return 0;
+}
+
+DISPMANX_ELEMENT_HANDLE_T vc_dispmanx_element_add(DISPMANX_UPDATE_HANDLE_T, DISPMANX_DISPLAY_HANDLE_T, int32_t,
+    const VC_RECT_T*, DISPMANX_RESOURCE_HANDLE_T, const VC_RECT_T*, DISPMANX_PROTECTION_T,
+    VC_DISPMANX_ALPHA_T*, DISPMANX_CLAMP_T*, DISPMANX_TRANSFORM_T)
+{
+    s_calls.elementAdd++;
+    return nextHandle();
+}
+
+int vc_dispmanx_element_remove(DISPMANX_UPDATE_HANDLE_T, DISPMANX_ELEMENT_HANDLE_T)
+{
+    s_calls.elementRemove++;
+    return 0;
+}
+
+int vc_dispmanx_element_change_source(DISPMANX_UPDATE_HANDLE_T, DISPMANX_ELEMENT_HANDLE_T, DISPMANX_RESOURCE_HANDLE_T)
+{
+    s_calls.elementChangeSource++;
+    return 0;
+}
+
+int vc_dispmanx_element_change_attributes(DISPMANX_UPDATE_HANDLE_T, DISPMANX_ELEMENT_HANDLE_T, uint32_t,
+    int32_t, uint8_t, const VC_RECT_T*, const VC_RECT_T*, DISPMANX_RESOURCE_HANDLE_T, DISPMANX_TRANSFORM_T)
+{
+    s_calls.elementChangeAttributes++;
+    return 0;
+}
+
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_resource_create(VC_IMAGE_TYPE_T, uint32_t, uint32_t, uint32_t* nativeImageHandle)
+{
+    s_calls.resourceCreate++;
+    *nativeImageHandle = 0;
+    return nextHandle();
+}
+
+int vc_dispmanx_resource_write_data(DISPMANX_RESOURCE_HANDLE_T, VC_IMAGE_TYPE_T, int pitch, void*, const VC_RECT_T* rect)
+{
+    s_calls.resourceWriteData++;
+    s_calls.bytesWritten += uint64_t(pitch) * rect->height;
+    return 0;
+}
+
+int vc_dispmanx_resource_delete(DISPMANX_RESOURCE_HANDLE_T)
+{
+    s_calls.resourceDelete++;
+    return 0;
+}
+
+int vc_dispmanx_rect_set(VC_RECT_T* rect, uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+{
+    rect->x = x;
+    rect->y = y;
+    rect->width = width;
+    rect->height = height;
+    return 0;
+}
+
+// Only wl_shm buffers exist without the VideoCore EGL.
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_get_handle_from_wl_buffer(struct wl_resource*)
+{
+    return DISPMANX_NO_HANDLE;
+}
+
+EGLDisplay eglGetDisplay(EGLNativeDisplayType)
+{
+    return reinterpret_cast<EGLDisplay>(1);
+}
+
+EGLBoolean eglInitialize(EGLDisplay, EGLint* major, EGLint* minor)
+{
+    if (major)
+        *major = 1;
+    if (minor)
+        *minor = 4;
+    return EGL_TRUE;
+}
+
+static EGLBoolean bindWaylandDisplay(EGLDisplay, struct wl_display*)
+{
+    return EGL_TRUE;
+}
+
+static EGLBoolean queryWaylandBuffer(EGLDisplay, struct wl_resource*, EGLint, EGLint*)
+{
+    return EGL_FALSE;
+}
+
+__eglMustCastToProperFunctionPointerType eglGetProcAddress(const char* name)
+{
+    if (!std::strcmp(name, "eglBindWaylandDisplayWL"))
+        return reinterpret_cast<__eglMustCastToProperFunctionPointerType>(bindWaylandDisplay);
+    if (!std::strcmp(name, "eglQueryWaylandBufferWL"))
+        return reinterpret_cast<__eglMustCastToProperFunctionPointerType>(queryWaylandBuffer);
+    return nullptr;
+}
+
+} // extern "C"
+
+namespace Stub {
+
+DispmanxCalls dispmanxCalls()
+{
+    return s_calls;
+}
+
+void resetDispmanxCalls()
+{
+    s_calls = DispmanxCalls();
+}
+
+void waitForUpdates()
+{
+    std::unique_lock<std::mutex> lock(s_display.mutex);
+    s_display.idle.wait(lock, [] { return s_display.stopping || s_display.pendingUpdates.empty(); });
+}
+
+} // namespace Stub
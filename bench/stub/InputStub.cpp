@@ -0,0 +1,265 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Stands in for udev and libinput. There are no devices: the events the
+// benchmarks queue through Stub are handed out by libinput_get_event(), and
+// the context's fd, an eventfd, is readable while any are waiting.
+
+#include "Stub.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <deque>
+#include <libinput.h>
+#include <libudev.h>
+#include <mutex>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+struct udev {
+};
+
+struct libinput {
+    int fd;
+};
+
+struct libinput_event {
+    enum libinput_event_type type;
+    uint64_t timeUsec;
+    uint32_t code;
+    uint32_t state;
+    double dx;
+    double dy;
+    bool hasAxis[2];
+    double axisValue[2];
+};
+
+// The typed events are the base event itself, as with the real library.
+struct libinput_event_keyboard {
+    struct libinput_event base;
+};
+
+struct libinput_event_pointer {
+    struct libinput_event base;
+};
+
+static std::mutex s_mutex;
+static std::deque<struct libinput_event*> s_events;
+static struct udev s_udev;
+static struct libinput s_libinput = { -1 };
+
+static uint64_t nowUsec()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void queueEvent(enum libinput_event_type type, const struct libinput_event& event)
+{
+    auto* queued = new struct libinput_event(event);
+    queued->type = type;
+    queued->timeUsec = nowUsec();
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_events.push_back(queued);
+    if (s_libinput.fd == -1)
+        return;
+
+    uint64_t value = 1;
+    if (write(s_libinput.fd, &value, sizeof(value)) != sizeof(value))
+        std::fprintf(stderr, "[Athol] Stub failed to signal queued input\n");
+}
+
+extern "C" {
+
+struct udev* udev_new(void)
+{
+    return &s_udev;
+}
+
+struct libinput* libinput_udev_create_context(const struct libinput_interface*, void*, struct udev*)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_libinput.fd == -1) {
+        s_libinput.fd = eventfd(s_events.size(), EFD_CLOEXEC | EFD_NONBLOCK);
+        if (s_libinput.fd == -1)
+            return nullptr;
+    }
+    return &s_libinput;
+}
+
+int libinput_udev_assign_seat(struct libinput*, const char*)
+{
+    return 0;
+}
+
+int libinput_get_fd(struct libinput* libinput)
+{
+    return libinput->fd;
+}
+
+int libinput_dispatch(struct libinput* libinput)
+{
+    // Readable again as soon as another event is queued.
+    uint64_t value;
+    if (read(libinput->fd, &value, sizeof(value)) != sizeof(value) && errno != EAGAIN)
+        return -errno;
+    return 0;
+}
+
+struct libinput_event* libinput_get_event(struct libinput*)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if (s_events.empty())
+        return nullptr;
+
+    struct libinput_event* event = s_events.front();
+    s_events.pop_front();
+    return event;
+}
+
+enum libinput_event_type libinput_event_get_type(struct libinput_event* event)
+{
+    return event->type;
+}
+
+void libinput_event_destroy(struct libinput_event* event)
+{
+    delete event;
+}
+
+struct libinput_event_keyboard* libinput_event_get_keyboard_event(struct libinput_event* event)
+{
+    return reinterpret_cast<struct libinput_event_keyboard*>(event);
+}
+
+struct libinput_event_pointer* libinput_event_get_pointer_event(struct libinput_event* event)
+{
+    return reinterpret_cast<struct libinput_event_pointer*>(event);
+}
+
+uint32_t libinput_event_keyboard_get_time(struct libinput_event_keyboard* event)
+{
+    return event->base.timeUsec / 1000;
+}
+
+uint64_t libinput_event_keyboard_get_time_usec(struct libinput_event_keyboard* event)
+{
+    return event->base.timeUsec;
+}
+
+uint32_t libinput_event_keyboard_get_key(struct libinput_event_keyboard* event)
+{
+    return event->base.code;
+}
+
+enum libinput_key_state libinput_event_keyboard_get_key_state(struct libinput_event_keyboard* event)
+{
+    return static_cast<enum libinput_key_state>(event->base.state);
+}
+
+uint32_t libinput_event_pointer_get_time(struct libinput_event_pointer* event)
+{
+    return event->base.timeUsec / 1000;
+}
+
+uint64_t libinput_event_pointer_get_time_usec(struct libinput_event_pointer* event)
+{
+    return event->base.timeUsec;
+}
+
+double libinput_event_pointer_get_dx(struct libinput_event_pointer* event)
+{
+    return event->base.dx;
+}
+
+double libinput_event_pointer_get_dy(struct libinput_event_pointer* event)
+{
+    return event->base.dy;
+}
+
+uint32_t libinput_event_pointer_get_button(struct libinput_event_pointer* event)
+{
+    return event->base.code;
+}
+
+enum libinput_button_state libinput_event_pointer_get_button_state(struct libinput_event_pointer* event)
+{
+    return static_cast<enum libinput_button_state>(event->base.state);
+}
+
+int libinput_event_pointer_has_axis(struct libinput_event_pointer* event, enum libinput_pointer_axis axis)
+{
+    return event->base.hasAxis[axis];
+}
+
+double libinput_event_pointer_get_axis_value(struct libinput_event_pointer* event, enum libinput_pointer_axis axis)
+{
+    return event->base.axisValue[axis];
+}
+
+} // extern "C"
+
+namespace Stub {
+
+void queueKeyboardKey(uint32_t key, bool pressed)
+{
+    struct libinput_event event = { };
+    event.code = key;
+    event.state = pressed ? LIBINPUT_KEY_STATE_PRESSED : LIBINPUT_KEY_STATE_RELEASED;
+    queueEvent(LIBINPUT_EVENT_KEYBOARD_KEY, event);
+}
+
+void queuePointerMotion(double dx, double dy)
+{
+    struct libinput_event event = { };
+    event.dx = dx;
+    event.dy = dy;
+    queueEvent(LIBINPUT_EVENT_POINTER_MOTION, event);
+}
+
+void queuePointerButton(uint32_t button, bool pressed)
+{
+    struct libinput_event event = { };
+    event.code = button;
+    event.state = pressed ? LIBINPUT_BUTTON_STATE_PRESSED : LIBINPUT_BUTTON_STATE_RELEASED;
+    queueEvent(LIBINPUT_EVENT_POINTER_BUTTON, event);
+}
+
+void queuePointerAxis(double vertical, double horizontal)
+{
+    struct libinput_event event = { };
+    event.hasAxis[LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL] = vertical != 0;
+    event.axisValue[LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL] = vertical;
+    event.hasAxis[LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL] = horizontal != 0;
+    event.axisValue[LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL] = horizontal;
+    queueEvent(LIBINPUT_EVENT_POINTER_AXIS, event);
+}
+
+} // namespace Stub
@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef Stub_h
+#define Stub_h
+
+#include <cstdint>
+
+// Control over the stub bcm_host, dispmanx, EGL, udev and libinput library
+// the compositor benchmarks link against instead of the real ones.
+//
+// Updates submitted to the stub complete on its display thread at the next
+// simulated vblank, ATHOL_STUB_REFRESH times a second (60 by default), or as
+// soon as they are submitted if that is 0.
+namespace Stub {
+
+struct DispmanxCalls {
+    uint64_t updateStart;
+    uint64_t updateSubmit;
+    uint64_t elementAdd;
+    uint64_t elementRemove;
+    uint64_t elementChangeSource;
+    uint64_t elementChangeAttributes;
+    uint64_t resourceCreate;
+    uint64_t resourceDelete;
+    uint64_t resourceWriteData;
+    uint64_t bytesWritten;
+};
+
+DispmanxCalls dispmanxCalls();
+void resetDispmanxCalls();
+
+// Blocks until every update submitted so far has completed.
+void waitForUpdates();
+
+// Queue an event for the libinput context and make its fd readable. The
+// time is taken when the event is queued.
+void queueKeyboardKey(uint32_t key, bool pressed);
+void queuePointerMotion(double dx, double dy);
+void queuePointerButton(uint32_t button, bool pressed);
+void queuePointerAxis(double vertical, double horizontal);
+
+} // namespace Stub
+
+#endif // Stub_h
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2015, Igalia S.L.
+ * Copyright (c) 2015, Metrological
+ * All rights reserved.
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer. 
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// The subset of bcm_host.h and vc_dispmanx.h that the dispmanx backend uses,
+// with the Broadcom names and values, so that it builds against the stub
+// library on hosts without the VideoCore userland.
+
+#ifndef bcm_host_h
+#define bcm_host_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint32_t DISPMANX_DISPLAY_HANDLE_T;
+typedef uint32_t DISPMANX_UPDATE_HANDLE_T;
+typedef uint32_t DISPMANX_ELEMENT_HANDLE_T;
+typedef uint32_t DISPMANX_RESOURCE_HANDLE_T;
+typedef uint32_t DISPMANX_PROTECTION_T;
+
+#define DISPMANX_NO_HANDLE 0
+#define DISPMANX_PROTECTION_NONE 0
+
+#define DISPMANX_ID_MAIN_LCD 0
+#define DISPMANX_ID_AUX_LCD 1
+#define DISPMANX_ID_HDMI 2
+#define DISPMANX_ID_SDTV 3
+
+typedef enum {
+    DISPMANX_NO_ROTATE = 0,
+    DISPMANX_ROTATE_90 = 1,
+    DISPMANX_ROTATE_180 = 2,
+    DISPMANX_ROTATE_270 = 3,
+    DISPMANX_FLIP_HRIZ = 1 << 16,
+    DISPMANX_FLIP_VERT = 1 << 17
+} DISPMANX_TRANSFORM_T;
+
+typedef enum {
+    DISPMANX_FLAGS_ALPHA_FROM_SOURCE = 0,
+    DISPMANX_FLAGS_ALPHA_FIXED_ALL_PIXELS = 1,
+    DISPMANX_FLAGS_ALPHA_FIXED_NON_ZERO = 2,
+    DISPMANX_FLAGS_ALPHA_FIXED_EXCEED_0X07 = 3,
+    DISPMANX_FLAGS_ALPHA_PREMULT = 1 << 16,
+    DISPMANX_FLAGS_ALPHA_MIX = 1 << 17
+} DISPMANX_FLAGS_ALPHA_T;
+
+typedef struct {
+    DISPMANX_FLAGS_ALPHA_T flags;
+    uint32_t opacity;
+    DISPMANX_RESOURCE_HANDLE_T mask;
+} VC_DISPMANX_ALPHA_T;
+
+typedef struct DISPMANX_CLAMP_T DISPMANX_CLAMP_T;
+
+typedef struct {
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+} VC_RECT_T;
+
+typedef enum {
+    VC_IMAGE_MIN = 0,
+    VC_IMAGE_RGB565 = 1,
+    VC_IMAGE_ARGB8888 = 43,
+    VC_IMAGE_XRGB8888 = 44
+} VC_IMAGE_TYPE_T;
+
+typedef void (*DISPMANX_CALLBACK_FUNC_T)(DISPMANX_UPDATE_HANDLE_T, void*);
+
+void bcm_host_init(void);
+void bcm_host_deinit(void);
+int32_t graphics_get_display_size(const uint16_t display, uint32_t* width, uint32_t* height);
+
+DISPMANX_DISPLAY_HANDLE_T vc_dispmanx_display_open(uint32_t device);
+int vc_dispmanx_display_close(DISPMANX_DISPLAY_HANDLE_T);
+int vc_dispmanx_vsync_callback(DISPMANX_DISPLAY_HANDLE_T, DISPMANX_CALLBACK_FUNC_T, void*);
+
+DISPMANX_UPDATE_HANDLE_T vc_dispmanx_update_start(int32_t priority);
+int vc_dispmanx_update_submit(DISPMANX_UPDATE_HANDLE_T, DISPMANX_CALLBACK_FUNC_T, void*);
+
+DISPMANX_ELEMENT_HANDLE_T vc_dispmanx_element_add(DISPMANX_UPDATE_HANDLE_T, DISPMANX_DISPLAY_HANDLE_T, int32_t layer,
+    const VC_RECT_T* destRect, DISPMANX_RESOURCE_HANDLE_T, const VC_RECT_T* srcRect, DISPMANX_PROTECTION_T,
+    VC_DISPMANX_ALPHA_T*, DISPMANX_CLAMP_T*, DISPMANX_TRANSFORM_T);
+int vc_dispmanx_element_remove(DISPMANX_UPDATE_HANDLE_T, DISPMANX_ELEMENT_HANDLE_T);
+int vc_dispmanx_element_change_source(DISPMANX_UPDATE_HANDLE_T, DISPMANX_ELEMENT_HANDLE_T, DISPMANX_RESOURCE_HANDLE_T);
+int vc_dispmanx_element_change_attributes(DISPMANX_UPDATE_HANDLE_T, DISPMANX_ELEMENT_HANDLE_T, uint32_t changeFlags,
+    int32_t layer, uint8_t opacity, const VC_RECT_T* destRect, const VC_RECT_T* srcRect,
+    DISPMANX_RESOURCE_HANDLE_T mask, DISPMANX_TRANSFORM_T);
+
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_resource_create(VC_IMAGE_TYPE_T, uint32_t width, uint32_t height, uint32_t* nativeImageHandle);
+int vc_dispmanx_resource_write_data(DISPMANX_RESOURCE_HANDLE_T, VC_IMAGE_TYPE_T, int pitch, void* src, const VC_RECT_T*);
+int vc_dispmanx_resource_delete(DISPMANX_RESOURCE_HANDLE_T);
+
+int vc_dispmanx_rect_set(VC_RECT_T*, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+#ifdef BUILD_WAYLAND
+struct wl_resource;
+DISPMANX_RESOURCE_HANDLE_T vc_dispmanx_get_handle_from_wl_buffer(struct wl_resource*);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // bcm_host_h